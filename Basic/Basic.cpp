@@ -4,68 +4,269 @@
  * This file is the starter project for the BASIC interpreter.
  */
 
+#include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <regex>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include "exp.hpp"
+#include "image.hpp"
 #include "parser.hpp"
 #include "program.hpp"
+#include "linereader.hpp"
+#include "pipeline.hpp"
+#include "server.hpp"
+#include "session.hpp"
 #include "Utils/error.hpp"
 #include "Utils/tokenScanner.hpp"
 #include "Utils/strlib.hpp"
 
 /* Function prototypes */
 
-void processLine(const std::string &line, Program &program, EvalState &state);
+void runInteractive(Session &session);
+
+void runPipelined(Session &session);
+
+int runServer(const std::string &path, long long steps, std::chrono::milliseconds time);
+
+int runBatch(const std::string &programFile, const std::string &recordFile,
+             long long steps, std::chrono::milliseconds time);
+
+bool parseLimit(const char *text, long long &limit);
+
+int saveSession(const Session &session, const std::string &filename);
 
 /* Main program */
 
-int main() {
-  EvalState state;
-  Program program;
+int main(int argc, char **argv) {
+  std::ios::sync_with_stdio(false);
   StatementType::init();
-  while (true) {
-    try {
-      std::string input;
-      getline(std::cin, input);
-      processLine(input, program, state);
-    } catch (ErrorException &ex) {
-      std::cout << ex.getMessage() << std::endl;
+  std::string servePath, programFile, recordFile;
+  std::string statsFile; //where to write the counters as JSON on exit
+  std::string restoreFile, snapshotFile; //where to read the session from and save it to on exit
+  bool pipelined = false;
+  long long steps = BASIC_STEP_LIMIT, milliseconds = BASIC_TIME_LIMIT_MS;
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    std::string option = argv[i];
+    if (option == "--serve" && i + 1 < argc) {
+      servePath = argv[++i];
+    } else if (option == "--batch" && i + 2 < argc) {
+      programFile = argv[++i];
+      recordFile = argv[++i];
+    } else if (option == "--stats" && i + 1 < argc) {
+      statsFile = argv[++i];
+    } else if (option == "--restore" && i + 1 < argc) {
+      restoreFile = argv[++i];
+    } else if (option == "--snapshot" && i + 1 < argc) {
+      snapshotFile = argv[++i];
+    } else if (option == "--pipeline") {
+      pipelined = true;
+    } else if (option == "--step-limit" && i + 1 < argc) {
+      valid = parseLimit(argv[++i], steps);
+    } else if (option == "--time-limit" && i + 1 < argc) {
+      valid = parseLimit(argv[++i], milliseconds);
+    } else {
+      valid = false;
     }
   }
+  if (!valid || (!servePath.empty() && !programFile.empty())) {
+    std::cerr << "usage: " << argv[0] << " [--step-limit N] [--time-limit MS]"
+              << " [--serve PATH | --batch PROGRAM RECORDS |"
+              << " [--pipeline] [--stats FILE] [--restore FILE] [--snapshot FILE]]\n";
+    return 2;
+  }
+  std::chrono::milliseconds time(milliseconds);
+  if (!servePath.empty()) return runServer(servePath, steps, time);
+  if (!programFile.empty()) return runBatch(programFile, recordFile, steps, time);
+
+  Session session;
+  try {
+    if (!restoreFile.empty()) session.restore(ProgramImage::loadSnapshot(restoreFile));
+  } catch (ErrorException &ex) {
+    std::cerr << ex.getMessage() << '\n';
+    return 1;
+  }
+  session.getProgram().setLimits(steps, time);
+  if (!pipelined || isatty(STDIN_FILENO) || std::thread::hardware_concurrency() < 2) {
+    runInteractive(session); //a second thread would only get in the way
+  } else {
+    runPipelined(session);
+  }
+  if (!statsFile.empty()) {
+    std::ofstream out(statsFile);
+    session.getState().getCounters().writeJson(out);
+  }
+  if (!snapshotFile.empty()) return saveSession(session, snapshotFile);
+  return 0;
 }
 
 /*
- * Function: processLine
- * Usage: processLine(line, program, state);
- * -----------------------------------------
- * Processes a single line entered by the user.  In this version of
- * implementation, the program reads a line, parses it as an expression,
- * and then prints the result.  In your implementation, you will
- * need to replace this method with one that can respond correctly
- * when the user enters a program line (which begins with a number)
- * or one of the BASIC commands, such as LIST or RUN.
+ * Function: runInteractive
+ * Usage: runInteractive(session);
+ * -------------------------------
+ * Reads and processes one line at a time from standard input until the
+ * input ends or QUIT is entered.  Used for terminals, and for piped
+ * input on machines with a single hardware thread.
  */
 
-void processLine(const std::string &line, Program &program, EvalState &state) {
-  static std::regex inputPattern("^([0-9]+\\s*)?([A-Z]+)?(.*)$");
-  std::smatch matches;
-  std::regex_match(line, matches, inputPattern);
-  int lineNumber = matches[1].matched ? std::stoi(matches[1].str()) : -1;
-  std::string command = matches[2];
-  std::string info = matches[3]; //may begin with space
-  if (command.empty()) {
-    if (lineNumber >= 0 && info.empty()) {
-      program.remove(lineNumber);
-    } else {
-      syntaxError();
+void runInteractive(Session &session) {
+  session.run(LineReader::standardInput(), std::cout);
+}
+
+/*
+ * Function: runPipelined
+ * Usage: runPipelined(session);
+ * -----------------------------
+ * Does the same as runInteractive for piped input, but lets a Pipeline
+ * parse the following lines while the current one executes.  Only used
+ * with --pipeline, as it has not been shown to be faster.
+ */
+
+void runPipelined(Session &session) {
+  Program &program = session.getProgram();
+  EvalState &state = session.getState();
+  Pipeline pipeline(STDIN_FILENO);
+  state.setInput(&pipeline);
+  try {
+    while (const ParsedLine *line = pipeline.next()) {
+      try {
+        line->apply(program, state);
+      } catch (ErrorException &ex) {
+        std::cout << ex.getMessage() << '\n';
+      }
     }
-  } else {
-    StatementType::get(command).eval(lineNumber, info, state, program);
-    if(lineNumber >= 0) {
-      program.addSourceLine(lineNumber, line);
+  } catch (QuitException &ex) {
+  }
+  std::cout.flush();
+}
+
+/*
+ * Function: runServer
+ * Usage: return runServer(path, steps, time);
+ * -------------------------------------------
+ * Serves sessions on the Unix-domain socket at path, one per connection
+ * and one worker thread per hardware thread, until the socket fails.
+ * Every RUN of a session may execute steps statements and take time,
+ * 0 for no limit.
+ */
+
+int runServer(const std::string &path, long long steps, std::chrono::milliseconds time) {
+  Server server(std::thread::hardware_concurrency());
+  server.setLimits(steps, time);
+  try {
+    server.serve(path);
+  } catch (ErrorException &ex) {
+    std::cerr << ex.getMessage() << '\n';
+  }
+  return 1;
+}
+
+/*
+ * Function: runBatch
+ * Usage: return runBatch(programFile, recordFile, steps, time);
+ * --------------------------------------------------------------
+ * Loads the program in programFile, as LOAD does, and runs it once for
+ * every line of recordFile, on one worker thread per hardware thread.
+ * The comma-separated fields of a record are the lines its INPUT
+ * statements read, in order, so a field cannot contain a comma.  The
+ * output of each run is written to standard output in the order of the
+ * records, and ends with a complete line: a run whose INPUT finds no
+ * field left prints NO MORE INPUT after the prompt and stops.  Each run
+ * is limited like the RUNs of runServer.
+ */
+
+int runBatch(const std::string &programFile, const std::string &recordFile,
+             long long steps, std::chrono::milliseconds time) {
+  std::ifstream records(recordFile);
+  if (!records) {
+    std::cerr << "FILE NOT FOUND" << '\n';
+    return 1;
+  }
+  Session session;
+  StringReader load("LOAD " + programFile + '\n');
+  std::ostringstream errors;
+  session.run(load, errors);
+  if (!errors.str().empty()) {
+    std::cerr << errors.str();
+    return 1;
+  }
+  try {
+    session.getProgram().link(); //once, instead of once per run
+  } catch (ErrorException &ex) {
+    std::cerr << ex.getMessage() << '\n';
+    return 1;
+  }
+  auto base = std::make_shared<const Session::Snapshot>(session.snapshot());
+
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t window = threads * 64; //runs submitted ahead of the one being written
+  Server server(threads);
+  server.setLimits(steps, time);
+  std::deque<std::future<std::string>> outputs;
+  std::string record;
+  while (true) {
+    bool more = bool(std::getline(records, record));
+    if (more) {
+      if (!record.empty() && record.back() == '\r') record.pop_back();
+      std::replace(record.begin(), record.end(), ',', '\n');
+      outputs.push_back(server.submit(base, record + '\n'));
+    }
+    if (outputs.empty()) break;
+    if (!more || outputs.size() >= window) {
+      std::string output = outputs.front().get();
+      std::cout.write(output.data(), output.size());
+      outputs.pop_front();
     }
   }
+  std::cout.flush();
+  return 0;
+}
+
+/*
+ * Function: parseLimit
+ * Usage: if (parseLimit(text, limit)) . . .
+ * -----------------------------------------
+ * Reads the value of --step-limit or --time-limit, a count that is 0
+ * for no limit, into limit and returns true, or returns false if text
+ * is no such count.
+ */
+
+bool parseLimit(const char *text, long long &limit) {
+  const char *end = text + strlen(text);
+  std::from_chars_result result = std::from_chars(text, end, limit);
+  return result.ec == std::errc() && result.ptr == end && limit >= 0;
 }
 
+/*
+ * Function: saveSession
+ * Usage: return saveSession(session, filename);
+ * ---------------------------------------------
+ * Saves the program and variables of a session whose input has ended
+ * to filename as a snapshot, which --restore carries on from with new
+ * input, and returns the exit status.  The line the input ended in is
+ * left out, as it has been processed as far as it ever will be.
+ */
+
+int saveSession(const Session &session, const std::string &filename) {
+  Session::Snapshot snapshot = session.snapshot();
+  snapshot.current.reset();
+  snapshot.next = 0;
+  snapshot.finished = false;
+  try {
+    ProgramImage::saveSnapshot(snapshot, filename);
+  } catch (ErrorException &ex) {
+    std::cerr << ex.getMessage() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * File: allocstats.cpp
+ * --------------------
+ * This file implements the allocstats.h interface.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include "allocstats.hpp"
+
+#ifdef BASIC_ALLOCATION_STATS
+
+namespace {
+
+struct Counters {
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<int64_t> live{0};
+};
+
+Counters counters[AllocationStats::SUBSYSTEM_COUNT]; //constant-initialized, so usable before main
+
+/*
+ * Put in front of every block, so that freeing it is charged to the
+ * subsystem that allocated it, with the right size, even without a
+ * sized delete.
+ */
+struct alignas(alignof(std::max_align_t)) Header {
+  size_t size;
+  AllocationStats::Subsystem subsystem;
+};
+
+}
+
+void *operator new(std::size_t size) {
+  auto *header = (Header *) std::malloc(sizeof(Header) + size);
+  if (header == nullptr) throw std::bad_alloc();
+  header->size = size;
+  header->subsystem = AllocationStats::current;
+  Counters &counter = counters[header->subsystem];
+  counter.allocations.fetch_add(1, std::memory_order_relaxed);
+  counter.bytes.fetch_add(size, std::memory_order_relaxed);
+  counter.live.fetch_add(int64_t(size), std::memory_order_relaxed);
+  return header + 1;
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) return;
+  Header *header = (Header *) ptr - 1;
+  counters[header->subsystem].live.fetch_sub(int64_t(header->size), std::memory_order_relaxed);
+  std::free(header);
+}
+
+void operator delete[](void *ptr) noexcept {
+  operator delete(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept {
+  operator delete(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept {
+  operator delete(ptr);
+}
+
+void AllocationStats::report(std::ostream &out) {
+  static const char *const NAMES[SUBSYSTEM_COUNT] = {"OTHER", "PARSER", "EVALUATOR", "PROGRAM", "IO"};
+  out << std::left << std::setw(12) << "SUBSYSTEM" << std::right << std::setw(14) << "ALLOCATIONS"
+      << std::setw(14) << "BYTES" << std::setw(14) << "LIVE BYTES" << '\n';
+  for (int i = 0; i < SUBSYSTEM_COUNT; i++) {
+    out << std::left << std::setw(12) << NAMES[i] << std::right
+        << std::setw(14) << counters[i].allocations.load(std::memory_order_relaxed)
+        << std::setw(14) << counters[i].bytes.load(std::memory_order_relaxed)
+        << std::setw(14) << counters[i].live.load(std::memory_order_relaxed) << '\n';
+  }
+}
+
+#else
+
+void AllocationStats::report(std::ostream &out) {
+  out << "ALLOCATION COUNTING IS NOT COMPILED IN\n";
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * File: allocstats.h
+ * ------------------
+ * This interface exports the AllocationStats class, which counts the
+ * heap allocations the interpreter makes, by the subsystem that makes
+ * them.
+ */
+
+#ifndef _allocstats_h
+#define _allocstats_h
+
+#include <cstddef>
+#include <ostream>
+
+/*
+ * Class: AllocationStats
+ * ----------------------
+ * Counting is only compiled in with the CMake option
+ * BASIC_ALLOCATION_STATS, which replaces the global operator new and
+ * delete.  Each thread has a current subsystem, set by the innermost
+ * Scope, and every allocation is charged to the subsystem that is
+ * current when it is made, as is freeing it later.  The counts are
+ * shared by all sessions in the process.  Without the option, Scope
+ * does nothing and costs nothing.
+ */
+
+class AllocationStats {
+
+public:
+
+  enum Subsystem {
+    OTHER, PARSER, EVALUATOR, PROGRAM, IO, SUBSYSTEM_COUNT
+  };
+
+/*
+ * Class: Scope
+ * Usage: AllocationStats::Scope scope(AllocationStats::PARSER);
+ * -------------------------------------------------------------
+ * Makes subsystem the current one of this thread until the scope ends.
+ */
+
+#ifdef BASIC_ALLOCATION_STATS
+  class Scope {
+  public:
+    explicit Scope(Subsystem subsystem) : saved(current) {
+      current = subsystem;
+    }
+
+    ~Scope() {
+      current = saved;
+    }
+
+    Scope(const Scope &) = delete;
+
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Subsystem saved;
+  };
+#else
+  class Scope {
+  public:
+    explicit Scope(Subsystem) {}
+  };
+#endif
+
+/*
+ * Method: report
+ * Usage: AllocationStats::report(out);
+ * ------------------------------------
+ * Writes a table of the allocations, bytes allocated and bytes still
+ * in use of every subsystem to out, or a note that counting is not
+ * compiled in.
+ */
+
+  static void report(std::ostream &out);
+
+private:
+
+#ifdef BASIC_ALLOCATION_STATS
+  static inline thread_local Subsystem current = OTHER;
+
+  friend void *operator new(std::size_t size);
+#endif
+
+};
+
+#endif
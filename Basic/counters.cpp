@@ -0,0 +1,43 @@
+/*
+ * File: counters.cpp
+ * ------------------
+ * This file implements the counters.h interface.
+ */
+
+#include <iomanip>
+#include "counters.hpp"
+#include "statement.hpp"
+
+void Counters::report(std::ostream &out) const {
+  uint64_t total = 0;
+  for (uint64_t count: statements) {
+    total += count;
+  }
+  auto line = [&out](std::string_view name, uint64_t count) {
+    out << std::left << std::setw(26) << name << std::right << std::setw(14) << count << '\n';
+  };
+  line("STATEMENTS", total);
+  for (int i = 0; i < MAX_STATEMENT_TYPES; i++) {
+    if (statements[i] > 0) line("  " + std::string(StatementType::keyword(i)), statements[i]);
+  }
+  line("EXPRESSIONS", expressions);
+  line("VARIABLE READS", reads);
+  line("VARIABLE WRITES", writes);
+  line("JUMPS", jumps);
+  line("LINKS", links);
+  line("IMAGE LOADS", imageLoads);
+  line("IMAGE REPARSES", imageReparses);
+}
+
+void Counters::writeJson(std::ostream &out) const {
+  out << "{\"statements\":{";
+  bool first = true;
+  for (int i = 0; i < MAX_STATEMENT_TYPES; i++) {
+    if (statements[i] == 0) continue;
+    out << (first ? "" : ",") << '"' << StatementType::keyword(i) << "\":" << statements[i];
+    first = false;
+  }
+  out << "},\"expressions\":" << expressions << ",\"reads\":" << reads << ",\"writes\":" << writes
+      << ",\"jumps\":" << jumps << ",\"links\":" << links << ",\"imageLoads\":" << imageLoads
+      << ",\"imageReparses\":" << imageReparses << "}\n";
+}
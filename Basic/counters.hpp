@@ -0,0 +1,55 @@
+/*
+ * File: counters.h
+ * ----------------
+ * This interface exports the Counters class, which counts what a
+ * session's programs and statements do, for the STATS command.
+ */
+
+#ifndef _counters_h
+#define _counters_h
+
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Class: Counters
+ * ---------------
+ * Plain counters owned by an EvalState, so that only the thread running
+ * the session touches them and each count is one increment.  Statements
+ * are counted by the index of their keyword.  Line numbers are resolved
+ * once, when a program is linked, so links stand in for line lookups;
+ * and the code section of a program image is the one cache of parsed
+ * lines, so LOAD counts whether it could use it.
+ */
+
+class Counters {
+
+public:
+
+  static const int MAX_STATEMENT_TYPES = 32;
+
+  uint64_t statements[MAX_STATEMENT_TYPES] = {}; //statements run, by keyword index
+  uint64_t expressions = 0; //expressions evaluated
+  uint64_t reads = 0; //of variables and array elements
+  uint64_t writes = 0; //of variables and array elements
+  uint64_t jumps = 0; //statements of a RUN that did not go on with the next one
+  uint64_t links = 0;
+  uint64_t imageLoads = 0; //LOADs that used the code section of an image
+  uint64_t imageReparses = 0; //LOADs that had to parse the source
+
+/*
+ * Methods: report, writeJson
+ * Usage: counters.report(out);
+ *        counters.writeJson(out);
+ * -------------------------------
+ * Write the counts to out, as a table for STATS or as one JSON object.
+ * Statement types that never ran are left out.
+ */
+
+  void report(std::ostream &out) const;
+
+  void writeJson(std::ostream &out) const;
+
+};
+
+#endif
@@ -1,13 +1,16 @@
 /*
  * File: evalstate.cpp
  * -------------------
- * This file implements the EvalState class, which defines a symbol
- * table for keeping track of the value of identifiers.  The public
- * methods are simple enough that they need no individual documentation.
+ * This file implements the EvalState class, which keeps track of the
+ * value of identifiers.  The public methods are simple enough that
+ * they need no individual documentation.
  */
 
 
+#include <iostream>
 #include "evalstate.hpp"
+#include "exp.hpp"
+#include "Utils/error.hpp"
 
 
 //using namespace std;
@@ -22,20 +25,86 @@ EvalState::~EvalState() {
     /* Empty */
 }
 
-void EvalState::setValue(std::string var, int value) {
-    if(isDefined(var)) symbolTable[var] = value;
-    else symbolTable.emplace(var,value);
+void EvalState::setValue(const std::string &var, Value value) {
+    setValue(Symbols::intern(var), value);
 }
 
-int EvalState::getValue(std::string var) {
-    if(isDefined(var)) return symbolTable[var];
-    else return 0;
+Value EvalState::getValue(const std::string &var) {
+    return getValue(Symbols::intern(var));
 }
 
-bool EvalState::isDefined(std::string var) {
-    return symbolTable.find(var)!=symbolTable.end();
+bool EvalState::isDefined(const std::string &var) {
+    return isDefined(Symbols::intern(var));
+}
+
+void EvalState::dimension(int var, Value size) {
+    if (size < 0) error("INVALID ARRAY SIZE");
+    if (size >= MAX_ARRAY_SIZE) error("ARRAY TOO LARGE");
+    if (size_t(var) >= arrays.size()) arrays.resize(var + 1);
+    arrays[var].assign(size + 1, 0);
+}
+
+void EvalState::elementError(int var) {
+    if (size_t(var) >= arrays.size() || arrays[var].empty()) error("ARRAY NOT DIMENSIONED");
+    error("INDEX OUT OF RANGE");
+}
+
+void EvalState::defineFunction(int name, int param, const CompiledExp &body) {
+    if (size_t(name) >= functions.size()) functions.resize(name + 1);
+    functions[name] = {param, std::make_shared<const CompiledExp>(body)};
+}
+
+void EvalState::defineFunction(int name, int param, std::shared_ptr<const CompiledExp> body) {
+    if (size_t(name) >= functions.size()) functions.resize(name + 1);
+    functions[name] = {param, std::move(body)};
+}
+
+Value EvalState::callFunction(int name, Value arg) {
+    if (size_t(name) >= functions.size() || functions[name].body == nullptr) error("FUNCTION NOT DEFINED");
+    if (callDepth == MAX_CALL_DEPTH) error("FUNCTION NESTING TOO DEEP");
+    Function function = functions[name]; //the body stays alive even if it is redefined meanwhile
+    Variable saved = isDefined(function.param) ? variables[function.param] : Variable{0, false};
+    setValue(function.param, arg);
+    callDepth++;
+    Value result;
+    try {
+        result = function.body->eval(*this);
+    } catch (...) {
+        callDepth--;
+        variables[function.param] = saved;
+        throw;
+    }
+    callDepth--;
+    variables[function.param] = saved;
+    return result;
 }
 
 void EvalState::Clear() {
-    symbolTable.clear();
-}
\ No newline at end of file
+    variables.clear();
+    arrays.clear();
+    functions.clear();
+}
+
+void EvalState::setInput(LineSource *input) {
+    this->input = input;
+}
+
+LineSource &EvalState::getInput() {
+    return input == nullptr ? LineReader::standardInput() : *input;
+}
+
+void EvalState::setOutput(std::ostream *output) {
+    this->output = output;
+}
+
+std::ostream &EvalState::getOutput() {
+    return output == nullptr ? std::cout : *output;
+}
+
+void EvalState::setWaiting(bool waiting) {
+    this->waiting = waiting;
+}
+
+bool EvalState::isWaiting() {
+    return waiting;
+}
@@ -10,21 +10,46 @@
 #define _evalstate_h
 
 #include <string>
-#include <map>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include "counters.hpp"
+#include "linereader.hpp"
+#include "symbols.hpp"
+
+/*
+ * Type: Value
+ * -----------
+ * The type of every value a BASIC program computes.  It is int, unless
+ * the interpreter is built with BASIC_WIDE_INTEGERS, in which case it
+ * is int64_t.
+ */
+
+#ifdef BASIC_WIDE_INTEGERS
+typedef int64_t Value;
+#else
+typedef int Value;
+#endif
+
+class CompiledExp;
 
 /*
  * Class: EvalState
  * ----------------
  * This class is passed by reference through the recursive levels
  * of the evaluator and contains information from the evaluation
- * environment that the evaluator may need to know.  In this
- * version, the only information maintained by the EvalState class
- * is a symbol table that maps variable names into their values.
- * In your implementation, you may include additional information
- * in the EvalState class.
+ * environment that the evaluator may need to know, most notably the
+ * values of variables and arrays.  Both are stored in vectors indexed
+ * by their Symbols id, so the evaluator reaches a variable with a single
+ * index; the methods taking a name intern it first.  Every array is one
+ * contiguous vector, and an element access costs a single unsigned
+ * comparison against its size.
  */
 
 class EvalState {
+    friend class ProgramImage;
 
 public:
 
@@ -50,19 +75,31 @@ public:
  * Method: setValue
  * Usage: state.setValue(var, value);
  * ----------------------------------
- * Sets the value associated with the specified var.
+ * Sets the value associated with the specified var, given by its
+ * name or its symbol id.
  */
 
-    void setValue(std::string var, int value);
+    void setValue(const std::string &var, Value value);
+
+    void setValue(int var, Value value) {
+        counters.writes++;
+        if (size_t(var) >= variables.size()) variables.resize(var + 1);
+        variables[var] = {value, true};
+    }
 
 /*
  * Method: getValue
- * Usage: int value = state.getValue(var);
+ * Usage: Value value = state.getValue(var);
  * ---------------------------------------
  * Returns the value associated with the specified variable.
  */
 
-    int getValue(std::string var);
+    Value getValue(const std::string &var);
+
+    Value getValue(int var) {
+        counters.reads++;
+        return size_t(var) < variables.size() ? variables[var].value : 0;
+    }
 
 /*
  * Method: isDefined
@@ -71,13 +108,179 @@ public:
  * Returns true if the specified variable is defined.
  */
 
-    bool isDefined(std::string var);
+    bool isDefined(const std::string &var);
+
+    bool isDefined(int var) {
+        return size_t(var) < variables.size() && variables[var].defined;
+    }
+
+/*
+ * Method: dimension
+ * Usage: state.dimension(var, size);
+ * ----------------------------------
+ * Creates the array var with the elements 0 through size, all zero.
+ * An existing array of that name is replaced, so a program that runs
+ * DIM again starts over with a fresh array.
+ */
+
+    void dimension(int var, Value size);
+
+/*
+ * Methods: getElement, setElement
+ * Usage: Value value = state.getElement(var, index);
+ *        state.setElement(var, index, value);
+ * -----------------------------------------------
+ * Read or write one element of the array var, raising an error if the
+ * array has not been dimensioned or index is out of its range.
+ */
+
+    Value getElement(int var, Value index) {
+        counters.reads++;
+        return element(var, index);
+    }
+
+    void setElement(int var, Value index, Value value) {
+        counters.writes++;
+        element(var, index) = value;
+    }
+
+/*
+ * Methods: getArraySize, getElementUnchecked, setElementUnchecked
+ * Usage: if (index < state.getArraySize(var)) . . .
+ * -------------------------------------------------
+ * getArraySize returns the number of elements of the array var, 0 if it
+ * has not been dimensioned.  The other two access an element whose
+ * index is known to be in range, without checking it again.
+ */
+
+    Value getArraySize(int var) const {
+        return size_t(var) < arrays.size() ? Value(arrays[var].size()) : 0;
+    }
+
+    Value getElementUnchecked(int var, Value index) {
+        counters.reads++;
+        return arrays[var][index];
+    }
+
+    void setElementUnchecked(int var, Value index, Value value) {
+        counters.writes++;
+        arrays[var][index] = value;
+    }
+
+/*
+ * Methods: defineFunction, callFunction, isDefinedAs
+ * Usage: state.defineFunction(name, param, body);
+ *        Value value = state.callFunction(name, arg);
+ *        if (state.isDefinedAs(name, body)) . . .
+ * ---------------------------------------------------
+ * DEF name(param) = body keeps body, or a copy of it, which
+ * callFunction evaluates with param bound to arg.  The old value of
+ * param is restored afterwards, so the parameter does not clobber a
+ * variable of the same name.  Calling a function that no DEF has
+ * defined, or nesting calls too deeply, raises an error.  isDefinedAs
+ * tells whether name is currently defined by the very body given,
+ * which a program that inlined that body checks before using it.
+ */
+
+    void defineFunction(int name, int param, const CompiledExp &body);
+
+    void defineFunction(int name, int param, std::shared_ptr<const CompiledExp> body);
+
+    bool isDefinedAs(int name, const CompiledExp *body) const {
+        return size_t(name) < functions.size() && functions[name].body.get() == body;
+    }
+
+    Value callFunction(int name, Value arg);
 
     void Clear();
 
+/*
+ * Methods: setInput, getInput
+ * Usage: state.setInput(&reader);
+ *        LineSource &input = state.getInput();
+ * --------------------------------------------
+ * Sets or returns the source INPUT statements take their values from.
+ * It is shared with the command loop, so both consume the same stream.
+ * Unless set otherwise, it is the reader for standard input.
+ */
+
+    void setInput(LineSource *input);
+
+    LineSource &getInput();
+
+/*
+ * Methods: setOutput, getOutput
+ * Usage: state.setOutput(&stream);
+ *        std::ostream &out = state.getOutput();
+ * ---------------------------------------------
+ * Sets or returns the stream PRINT, INPUT prompts, LIST and error
+ * messages are written to, so that every session has its own.  Unless
+ * set otherwise, it is std::cout.
+ */
+
+    void setOutput(std::ostream *output);
+
+    std::ostream &getOutput();
+
+/*
+ * Methods: setWaiting, isWaiting
+ * Usage: state.setWaiting(true);
+ *        if (state.isWaiting()) . . .
+ * -----------------------------------
+ * INPUT sets this flag when its line has not arrived yet, so that
+ * whatever is executing statements stops and tries that INPUT again
+ * later, and clears it once it has read a line.  While it is set, the
+ * prompt has already been shown.
+ */
+
+    void setWaiting(bool waiting);
+
+    bool isWaiting();
+
+/*
+ * Method: getCounters
+ * Usage: state.getCounters().expressions++;
+ * -----------------------------------------
+ * Returns the counters of this session, for STATS.
+ */
+
+    Counters &getCounters() {
+        return counters;
+    }
+
 private:
 
-    std::map<std::string, int> symbolTable;
+    struct Variable {
+        Value value;
+        bool defined;
+    };
+
+    struct Function {
+        int param;
+        std::shared_ptr<const CompiledExp> body; //null if not defined
+    };
+
+    static const Value MAX_ARRAY_SIZE = 1 << 24;
+    static const int MAX_CALL_DEPTH = 256;
+
+    std::vector<Variable> variables; //indexed by symbol id
+    std::vector<std::vector<Value>> arrays; //indexed by symbol id, empty if not dimensioned
+    std::vector<Function> functions; //indexed by symbol id
+    int callDepth = 0;
+    LineSource *input = nullptr;
+    std::ostream *output = nullptr;
+    bool waiting = false;
+    Counters counters;
+
+    Value &element(int var, Value index) {
+        //negative indices wrap around to huge ones, so one comparison checks both ends
+        if (size_t(var) >= arrays.size() || std::make_unsigned_t<Value>(index) >= arrays[var].size()) {
+            elementError(var);
+        }
+        return arrays[var][index];
+    }
+
+    void elementError(int var);
 
 };
 
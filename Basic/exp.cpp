@@ -4,6 +4,9 @@
  * This file implements the Expression class and its subclasses.
  */
 
+#include <algorithm>
+#include <charconv>
+#include <memory>
 #include "exp.hpp"
 
 
@@ -25,41 +28,42 @@ Expression::~Expression() = default;
  * value of state but needs it to match the general prototype for eval.
  */
 
-ConstantExp::ConstantExp(int value) {
+ConstantExp::ConstantExp(Value value) {
     this->value = value;
 }
 
-int ConstantExp::eval(EvalState &state) {
+Value ConstantExp::eval(EvalState &state) {
     return value;
 }
 
 std::string ConstantExp::toString() {
-    return integerToString(value);
+    return std::to_string(value);
 }
 
 ExpressionType ConstantExp::getType() {
     return CONSTANT;
 }
 
-int ConstantExp::getValue() {
+Value ConstantExp::getValue() {
     return value;
 }
 
 /*
  * Implementation notes: the IdentifierExp subclass
  * ------------------------------------------------
- * The IdentifierExp subclass declares a single instance variable that
- * stores the name of the variable.  The implementation of eval must
- * look this variable up in the evaluation state.
+ * The IdentifierExp subclass stores the name of the variable together
+ * with its symbol id, which is interned once by the constructor.  The
+ * implementation of eval looks the id up in the evaluation state.
  */
 
 IdentifierExp::IdentifierExp(std::string name) {
     this->name = name;
+    this->id = Symbols::intern(this->name);
 }
 
-int IdentifierExp::eval(EvalState &state) {
-    if (!state.isDefined(name)) error("VARIABLE NOT DEFINED");
-    return state.getValue(name);
+Value IdentifierExp::eval(EvalState &state) {
+    if (!state.isDefined(id)) error("VARIABLE NOT DEFINED");
+    return state.getValue(id);
 }
 
 std::string IdentifierExp::toString() {
@@ -70,10 +74,94 @@ ExpressionType IdentifierExp::getType() {
     return IDENTIFIER;
 }
 
-std::string IdentifierExp::getName() {
+const std::string &IdentifierExp::getName() {
     return name;
 }
 
+int IdentifierExp::getId() {
+    return id;
+}
+
+/*
+ * Implementation notes: the ArrayExp subclass
+ * -------------------------------------------
+ * The ArrayExp subclass stores the name and symbol id of the array and
+ * owns the index expression, which eval computes before the element is
+ * looked up in the evaluation state.
+ */
+
+ArrayExp::ArrayExp(std::string name, Expression *index) {
+    this->name = name;
+    this->id = Symbols::intern(this->name);
+    this->index = index;
+}
+
+ArrayExp::~ArrayExp() {
+    delete index;
+}
+
+Value ArrayExp::eval(EvalState &state) {
+    return state.getElement(id, index->eval(state));
+}
+
+std::string ArrayExp::toString() {
+    return name + '(' + index->toString() + ')';
+}
+
+ExpressionType ArrayExp::getType() {
+    return ARRAY;
+}
+
+const std::string &ArrayExp::getName() {
+    return name;
+}
+
+int ArrayExp::getId() {
+    return id;
+}
+
+Expression *ArrayExp::getIndex() {
+    return index;
+}
+
+/*
+ * Implementation notes: the CallExp subclass
+ * ------------------------------------------
+ * The CallExp subclass stores the name and symbol id of the function
+ * and owns the argument, which eval computes before the evaluation state
+ * runs the body of the function on it.
+ */
+
+CallExp::CallExp(std::string name, Expression *arg) {
+    this->name = name;
+    this->id = Symbols::intern(this->name);
+    this->arg = arg;
+}
+
+CallExp::~CallExp() {
+    delete arg;
+}
+
+Value CallExp::eval(EvalState &state) {
+    return state.callFunction(id, arg->eval(state));
+}
+
+std::string CallExp::toString() {
+    return name + '(' + arg->toString() + ')';
+}
+
+ExpressionType CallExp::getType() {
+    return CALL;
+}
+
+int CallExp::getId() {
+    return id;
+}
+
+Expression *CallExp::getArg() {
+    return arg;
+}
+
 /*
  * Implementation notes: the CompoundExp subclass
  * ----------------------------------------------
@@ -86,6 +174,20 @@ CompoundExp::CompoundExp(std::string op, Expression *lhs, Expression *rhs) {
     this->op = op;
     this->lhs = lhs;
     this->rhs = rhs;
+    if (this->op == "=") {
+        std::string message;
+        if (lhs->getType() != IDENTIFIER && lhs->getType() != ARRAY) {
+            message = "Illegal variable in assignment";
+        } else if (lhs->getType() == IDENTIFIER && ((IdentifierExp *) lhs)->getName() == "LET") {
+            message = "SYNTAX ERROR";
+        }
+        if (!message.empty()) {
+            delete lhs;
+            delete rhs;
+            error(message);
+        }
+        target = lhs;
+    }
 }
 
 CompoundExp::~CompoundExp() {
@@ -97,30 +199,41 @@ CompoundExp::~CompoundExp() {
  * Implementation notes: eval
  * --------------------------
  * The eval method for the compound expression case must check for the
- * assignment operator as a special case.  Unlike the arithmetic operators
- * the assignment operator does not evaluate its left operand.
+ * assignment operator and the short-circuiting AND and OR as special
+ * cases.  Unlike the arithmetic operators
+ * the assignment operator does not evaluate its left operand; its target
+ * was already checked by the constructor, so no strings are built here.
+ * The index of an element target is evaluated after the value, as it
+ * is by LET.
  */
 
-int CompoundExp::eval(EvalState &state) {
-    if (op == "=") {
-        if (lhs->getType() != IDENTIFIER) {
-            error("Illegal variable in assignment");
+Value CompoundExp::eval(EvalState &state) {
+    if (target != nullptr) {
+        if (target->getType() == ARRAY) {
+            ArrayExp *element = (ArrayExp *) target;
+            Value val = rhs->eval(state);
+            Value index = element->getIndex()->eval(state);
+            state.setElement(element->getId(), index, val);
+            return val;
         }
-        if (lhs->getType() == IDENTIFIER && lhs->toString() == "LET")
-            error("SYNTAX ERROR");
-        int val = rhs->eval(state);
-        state.setValue(((IdentifierExp *) lhs)->getName(), val);
+        Value val = rhs->eval(state);
+        state.setValue(((IdentifierExp *) target)->getId(), val);
         return val;
     }
-    int left = lhs->eval(state);
-    int right = rhs->eval(state);
-    if (op == "+") return left + right;
-    if (op == "-") return left - right;
-    if (op == "*") return left * right;
-    if (op == "/") {
-        if (right == 0) error("DIVIDE BY ZERO");
-        return left / right;
-    }
+    if (op == "AND") return lhs->eval(state) != 0 && rhs->eval(state) != 0;
+    if (op == "OR") return lhs->eval(state) != 0 || rhs->eval(state) != 0;
+    Value left = lhs->eval(state);
+    Value right = rhs->eval(state);
+    if (op == "+") return addValues(left, right);
+    if (op == "-") return subtractValues(left, right);
+    if (op == "*") return multiplyValues(left, right);
+    if (op == "/") return divideValues(left, right);
+    if (op == "==") return left == right;
+    if (op == "<>") return left != right;
+    if (op == "<") return left < right;
+    if (op == ">") return left > right;
+    if (op == "<=") return left <= right;
+    if (op == ">=") return left >= right;
     return 0;
 }
 
@@ -132,7 +245,7 @@ ExpressionType CompoundExp::getType() {
     return COMPOUND;
 }
 
-std::string CompoundExp::getOp() {
+const std::string &CompoundExp::getOp() {
     return op;
 }
 
@@ -143,3 +256,353 @@ Expression *CompoundExp::getLHS() {
 Expression *CompoundExp::getRHS() {
     return rhs;
 }
+
+Expression *CompoundExp::getTarget() {
+    return target;
+}
+
+/*
+ * Implementation notes: stringToValue
+ * -----------------------------------
+ * std::from_chars does the range check, so values that do not fit are
+ * rejected instead of being truncated or throwing.
+ */
+
+bool stringToValue(std::string_view str, Value &value) {
+    const char *first = str.data(), *last = str.data() + str.size();
+    std::from_chars_result result = std::from_chars(first, last, value);
+    return first != last && result.ec == std::errc() && result.ptr == last;
+}
+
+/*
+ * Implementation notes: the CompiledExp class
+ * -------------------------------------------
+ * compile emits the nodes of each subtree in postfix order and returns
+ * the stack height the subtree needs, so eval only allocates when an
+ * unusually deep expression does not fit into the fixed local stack.
+ * Assignment evaluates only its right operand and then stores the value
+ * on top of the stack, leaving it there as the result; an element target
+ * pushes its index on top of the value.  The last node of a lone variable or element
+ * is its PUSH_VAR or PUSH_ELEMENT, so store runs everything before it
+ * to get the index and then writes instead of reading.  AND and OR
+ * compile to a test after their left operand that jumps past the right
+ * one when it cannot change the result.  A call compiles to its argument
+ * followed by CALL_FUNCTION, which inlineCall may later replace by the body.
+ */
+
+CompiledExp::CompiledExp() = default;
+
+CompiledExp::CompiledExp(Expression *exp) {
+    depth = compile(exp);
+}
+
+int CompiledExp::compile(Expression *exp) {
+    switch (exp->getType()) {
+        case CONSTANT:
+            code.push_back({PUSH_CONST, ((ConstantExp *) exp)->getValue()});
+            return 1;
+        case IDENTIFIER:
+            code.push_back({PUSH_VAR, ((IdentifierExp *) exp)->getId()});
+            return 1;
+        case ARRAY: {
+            int height = compile(((ArrayExp *) exp)->getIndex());
+            code.push_back({PUSH_ELEMENT, ((ArrayExp *) exp)->getId()});
+            return height;
+        }
+        case CALL: {
+            int height = compile(((CallExp *) exp)->getArg());
+            code.push_back({CALL_FUNCTION, ((CallExp *) exp)->getId()});
+            return height;
+        }
+        default:
+            break;
+    }
+    CompoundExp *compound = (CompoundExp *) exp;
+    const std::string &op = compound->getOp();
+    Expression *target = compound->getTarget();
+    if (target != nullptr && target->getType() == ARRAY) {
+        int value = compile(compound->getRHS());
+        int index = compile(((ArrayExp *) target)->getIndex());
+        code.push_back({STORE_ELEMENT, ((ArrayExp *) target)->getId()});
+        return std::max(value, index + 1);
+    }
+    if (target != nullptr) {
+        int height = compile(compound->getRHS());
+        code.push_back({ASSIGN, ((IdentifierExp *) target)->getId()});
+        return height;
+    }
+    if (op == "AND" || op == "OR") {
+        int left = compile(compound->getLHS());
+        size_t test = code.size();
+        code.push_back({op == "AND" ? AND_THEN : OR_ELSE, 0});
+        int right = compile(compound->getRHS());
+        code.push_back({BOOL, 0});
+        code[test].operand = Value(code.size());
+        return std::max(left, right);
+    }
+    int left = compile(compound->getLHS());
+    int right = compile(compound->getRHS());
+    if (op == "+") code.push_back({ADD, 0});
+    else if (op == "-") code.push_back({SUB, 0});
+    else if (op == "*") code.push_back({MUL, 0});
+    else if (op == "/") code.push_back({DIV, 0});
+    else if (op == "==") code.push_back({EQ, 0});
+    else if (op == "<>") code.push_back({NE, 0});
+    else if (op == "<") code.push_back({LT, 0});
+    else if (op == ">") code.push_back({GT, 0});
+    else if (op == "<=") code.push_back({LE, 0});
+    else if (op == ">=") code.push_back({GE, 0});
+    else error("Illegal operator in expression");
+    return std::max(left, right + 1);
+}
+
+Value CompiledExp::eval(EvalState &state) const {
+    return run(state, code.size());
+}
+
+bool CompiledExp::isEmpty() const {
+    return code.empty();
+}
+
+bool CompiledExp::isVariable() const {
+    return code.size() == 1 && code[0].op == PUSH_VAR;
+}
+
+bool CompiledExp::isElement() const {
+    return !code.empty() && (code.back().op == PUSH_ELEMENT || code.back().op == PUSH_ELEMENT_UNCHECKED);
+}
+
+int CompiledExp::getSymbol() const {
+    return int(code.back().operand);
+}
+
+Value CompiledExp::evalIndex(EvalState &state) const {
+    return run(state, code.size() - 1);
+}
+
+void CompiledExp::store(EvalState &state, Value value) const {
+    if (code.back().op == PUSH_ELEMENT_UNCHECKED) {
+        state.setElementUnchecked(getSymbol(), evalIndex(state), value);
+    } else if (isElement()) {
+        state.setElement(getSymbol(), evalIndex(state), value);
+    } else {
+        state.setValue(getSymbol(), value);
+    }
+}
+
+Value CompiledExp::run(EvalState &state, size_t count) const {
+    state.getCounters().expressions++;
+    Value local[STACK_SIZE];
+    std::unique_ptr<Value[]> heap;
+    Value *stack = local;
+    if (depth > STACK_SIZE) {
+        heap.reset(new Value[depth]);
+        stack = heap.get();
+    }
+    stack[0] = 0; //what an empty prefix leaves, so the result is never read uninitialized
+    int top = 0;
+    for (const Node *node = code.data(), *end = node + count; node < end; node++) {
+        switch (node->op) {
+            case PUSH_CONST:
+                stack[top++] = node->operand;
+                break;
+            case PUSH_VAR:
+                if (!state.isDefined(node->operand)) error("VARIABLE NOT DEFINED");
+                stack[top++] = state.getValue(node->operand);
+                break;
+            case ADD:
+                top--;
+                stack[top - 1] = addValues(stack[top - 1], stack[top]);
+                break;
+            case SUB:
+                top--;
+                stack[top - 1] = subtractValues(stack[top - 1], stack[top]);
+                break;
+            case MUL:
+                top--;
+                stack[top - 1] = multiplyValues(stack[top - 1], stack[top]);
+                break;
+            case DIV:
+                top--;
+                stack[top - 1] = divideValues(stack[top - 1], stack[top]);
+                break;
+            case EQ:
+                top--;
+                stack[top - 1] = stack[top - 1] == stack[top];
+                break;
+            case NE:
+                top--;
+                stack[top - 1] = stack[top - 1] != stack[top];
+                break;
+            case LT:
+                top--;
+                stack[top - 1] = stack[top - 1] < stack[top];
+                break;
+            case GT:
+                top--;
+                stack[top - 1] = stack[top - 1] > stack[top];
+                break;
+            case LE:
+                top--;
+                stack[top - 1] = stack[top - 1] <= stack[top];
+                break;
+            case GE:
+                top--;
+                stack[top - 1] = stack[top - 1] >= stack[top];
+                break;
+            case AND_THEN:
+                if (stack[top - 1] == 0) {
+                    node = code.data() + node->operand - 1; //the result is the 0 on the stack
+                } else {
+                    top--;
+                }
+                break;
+            case OR_ELSE:
+                if (stack[top - 1] != 0) {
+                    stack[top - 1] = 1;
+                    node = code.data() + node->operand - 1;
+                } else {
+                    top--;
+                }
+                break;
+            case BOOL:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case ASSIGN:
+                state.setValue(node->operand, stack[top - 1]);
+                break;
+            case PUSH_ELEMENT:
+                stack[top - 1] = state.getElement(node->operand, stack[top - 1]);
+                break;
+            case STORE_ELEMENT:
+                top--;
+                state.setElement(node->operand, stack[top], stack[top - 1]);
+                break;
+            case PUSH_ELEMENT_UNCHECKED:
+                stack[top - 1] = state.getElementUnchecked(node->operand, stack[top - 1]);
+                break;
+            case STORE_ELEMENT_UNCHECKED:
+                top--;
+                state.setElementUnchecked(node->operand, stack[top], stack[top - 1]);
+                break;
+            case CALL_FUNCTION:
+                stack[top - 1] = state.callFunction(node->operand, stack[top - 1]);
+                break;
+            case PUSH_SLOT:
+                stack[top] = stack[node->operand];
+                top++;
+                break;
+            case COLLAPSE:
+                top--;
+                stack[top - 1] = stack[top];
+                break;
+        }
+    }
+    return stack[0];
+}
+
+bool CompiledExp::hasCalls() const {
+    return std::any_of(code.begin(), code.end(), [](const Node &node) { return node.op == CALL_FUNCTION; });
+}
+
+/*
+ * Implementation notes: inlineCall
+ * --------------------------------
+ * Heights are static, so the slot of the argument of each call is the
+ * height before its CALL_FUNCTION minus one, and the height at every
+ * node is the one reached along the fall-through path.  Jump operands
+ * are absolute, so those of the body are moved to where it is copied
+ * and those of the expression are remapped once the new code is
+ * complete.
+ */
+
+bool CompiledExp::inlineCall(int function, int param, const CompiledExp &body) {
+    if (body.code.empty() || body.code.size() > INLINE_LIMIT) return false;
+    for (const Node &node: body.code) {
+        if (node.op == CALL_FUNCTION || (node.op == ASSIGN && node.operand == param)) return false;
+    }
+    std::vector<Node> inlined;
+    std::vector<Value> moved(code.size() + 1); //new index of each old node
+    int height = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        const Node &node = code[i];
+        moved[i] = Value(inlined.size());
+        if (node.op == CALL_FUNCTION && node.operand == function) {
+            Value start = Value(inlined.size());
+            for (Node copy: body.code) {
+                if (copy.op == PUSH_VAR && copy.operand == param) {
+                    copy = {PUSH_SLOT, height - 1};
+                } else if (copy.op == AND_THEN || copy.op == OR_ELSE) {
+                    copy.operand += start;
+                }
+                inlined.push_back(copy);
+            }
+            inlined.push_back({COLLAPSE, 0});
+        } else {
+            inlined.push_back(node);
+        }
+        height += stackEffect(node.op);
+    }
+    if (inlined.size() == code.size()) return false;
+    moved[code.size()] = Value(inlined.size());
+    for (size_t i = 0; i < code.size(); i++) {
+        Node &node = inlined[moved[i]];
+        if (code[i].op == AND_THEN || code[i].op == OR_ELSE) node.operand = moved[code[i].operand];
+    }
+    code.swap(inlined);
+    depth = 0;
+    height = 0;
+    for (const Node &node: code) {
+        height += stackEffect(node.op);
+        depth = std::max(depth, height);
+    }
+    return true;
+}
+
+bool CompiledExp::assigns(int var) const {
+    return std::any_of(code.begin(), code.end(), [var](const Node &node) {
+        return node.op == ASSIGN && node.operand == var;
+    });
+}
+
+/*
+ * Implementation notes: uncheckElements
+ * -------------------------------------
+ * The index of an access is just the variable if the node before it
+ * pushes that variable.  No AND_THEN or OR_ELSE can jump to the access
+ * itself, as the node before a jump target is always a BOOL.
+ */
+
+bool CompiledExp::uncheckElements(int index, std::vector<int> &arrays) {
+    bool changed = false;
+    for (size_t i = 1; i < code.size(); i++) {
+        if (code[i - 1].op != PUSH_VAR || code[i - 1].operand != index) continue;
+        if (code[i].op == PUSH_ELEMENT) {
+            code[i].op = PUSH_ELEMENT_UNCHECKED;
+        } else if (code[i].op == STORE_ELEMENT) {
+            code[i].op = STORE_ELEMENT_UNCHECKED;
+        } else {
+            continue;
+        }
+        arrays.push_back(int(code[i].operand));
+        changed = true;
+    }
+    return changed;
+}
+
+int CompiledExp::stackEffect(OpCode op) {
+    switch (op) {
+        case PUSH_CONST:
+        case PUSH_VAR:
+        case PUSH_SLOT:
+            return 1;
+        case ASSIGN:
+        case PUSH_ELEMENT:
+        case PUSH_ELEMENT_UNCHECKED:
+        case BOOL:
+        case CALL_FUNCTION:
+            return 0;
+        default:
+            return -1;
+    }
+}
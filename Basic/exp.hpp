@@ -10,19 +10,23 @@
 #define _exp_h
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <type_traits>
 #include "Utils/error.hpp"
 #include "evalstate.hpp"
+#include "symbols.hpp"
 #include "Utils/strlib.hpp"
 
 /*
  * Type: ExpressionType
  * --------------------
- * This enumerated type is used to differentiate the three different
- * expression types: CONSTANT, IDENTIFIER, and COMPOUND.
+ * This enumerated type is used to differentiate the five different
+ * expression types: CONSTANT, IDENTIFIER, ARRAY, CALL, and COMPOUND.
  */
 
 enum ExpressionType {
-    CONSTANT, IDENTIFIER, COMPOUND
+    CONSTANT, IDENTIFIER, ARRAY, CALL, COMPOUND
 };
 
 /*
@@ -31,12 +35,14 @@ enum ExpressionType {
  * This class is used to represent a node in an expression tree.
  * Expression is an example of an abstract class, which defines
  * the structure and behavior of a set of classes but has no
- * objects of its own.  Any object must be one of the three
+ * objects of its own.  Any object must be one of the five
  * concrete subclasses of Expression:
  *
  *  1. ConstantExp   -- an integer constant
  *  2. IdentifierExp -- a string representing an identifier
- *  3. CompoundExp   -- two expressions combined by an operator
+ *  3. ArrayExp      -- an element of an array, selected by an index
+ *  4. CallExp       -- a call of a function defined by DEF
+ *  5. CompoundExp   -- two expressions combined by an operator
  *
  * The Expression class defines the interface common to all
  * Expression objects; each subclass provides its own specific
@@ -74,13 +80,13 @@ public:
 
 /*
  * Method: eval
- * Usage: int value = exp->eval(state);
+ * Usage: Value value = exp->eval(state);
  * ------------------------------------
  * Evaluates this expression and returns its value in the context of
  * the specified EvalState object.
  */
 
-    virtual int eval(EvalState &state) = 0;
+    virtual Value eval(EvalState &state) = 0;
 
 /*
  * Method: toString
@@ -96,7 +102,7 @@ public:
  * Usage: ExpressionType type = exp->getType();
  * --------------------------------------------
  * Returns the type of the expression, which must be one of the constants
- * CONSTANT, IDENTIFIER, or COMPOUND.
+ * CONSTANT, IDENTIFIER, ARRAY, CALL, or COMPOUND.
  */
 
     virtual ExpressionType getType() = 0;
@@ -121,7 +127,7 @@ public:
  * to the given value.
  */
 
-    ConstantExp(int value);
+    ConstantExp(Value value);
 
 /*
  * Prototypes for the virtual methods
@@ -130,7 +136,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -138,17 +144,17 @@ public:
 
 /*
  * Method: getValue
- * Usage: int value = ((ConstantExp *) exp)->getValue();
+ * Usage: Value value = ((ConstantExp *) exp)->getValue();
  * -----------------------------------------------------
  * Returns the value field without calling eval and can be applied
  * only to an object known to be a ConstantExp.
  */
 
-    int getValue();
+    Value getValue();
 
 private:
 
-    int value;
+    Value value;
 
 };
 
@@ -179,7 +185,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -187,17 +193,144 @@ public:
 
 /*
  * Method: getName
- * Usage: string name = ((IdentifierExp *) exp)->getName();
- * --------------------------------------------------------
+ * Usage: const string &name = ((IdentifierExp *) exp)->getName();
+ * ---------------------------------------------------------------
  * Returns the name field of the identifier node and can be applied only
- * to an object known to be an IdentifierExp.
+ * to an object known to be an IdentifierExp.  The reference stays valid
+ * for the lifetime of the node.
  */
 
-    std::string getName();
+    const std::string &getName();
+
+/*
+ * Method: getId
+ * Usage: int id = ((IdentifierExp *) exp)->getId();
+ * -------------------------------------------------
+ * Returns the symbol id the name was interned as when the node was
+ * created (see symbols.h).
+ */
+
+    int getId();
+
+private:
+
+    std::string name;
+    int id;
+
+};
+
+/*
+ * Class: ArrayExp
+ * ---------------
+ * This subclass represents an element of an array, written A(I).
+ * Arrays are separate from variables, so A and A(I) may both be used.
+ */
+
+class ArrayExp : public Expression {
+
+public:
+
+/*
+ * Constructor: ArrayExp
+ * Usage: Expression *exp = new ArrayExp(name, index);
+ * ---------------------------------------------------
+ * The constructor initializes a new element expression for the array
+ * named by name.  The node takes ownership of index.
+ */
+
+    ArrayExp(std::string name, Expression *index);
+
+/*
+ * Prototypes for the virtual methods
+ * ----------------------------------
+ * These methods have the same prototypes as those in the Expression
+ * base class and don't require additional documentation.
+ */
+
+    virtual ~ArrayExp();
+
+    virtual Value eval(EvalState &state);
+
+    virtual std::string toString();
+
+    virtual ExpressionType getType();
+
+/*
+ * Methods: getName, getId, getIndex
+ * Usage: int id = ((ArrayExp *) exp)->getId();
+ * --------------------------------------------
+ * These methods return the components of an element node and can be
+ * applied only to an object known to be an ArrayExp.
+ */
+
+    const std::string &getName();
+
+    int getId();
+
+    Expression *getIndex();
 
 private:
 
     std::string name;
+    int id;
+    Expression *index;
+
+};
+
+/*
+ * Class: CallExp
+ * --------------
+ * This subclass represents a call FNA(X) of a function defined by
+ * DEF FNA(P) = body.  Any name beginning with FN that is followed by
+ * a parenthesis is a call rather than an array element.
+ */
+
+class CallExp : public Expression {
+
+public:
+
+/*
+ * Constructor: CallExp
+ * Usage: Expression *exp = new CallExp(name, arg);
+ * ------------------------------------------------
+ * The constructor initializes a new call of the function named by
+ * name.  The node takes ownership of arg.
+ */
+
+    CallExp(std::string name, Expression *arg);
+
+/*
+ * Prototypes for the virtual methods
+ * ----------------------------------
+ * These methods have the same prototypes as those in the Expression
+ * base class and don't require additional documentation.
+ */
+
+    virtual ~CallExp();
+
+    virtual Value eval(EvalState &state);
+
+    virtual std::string toString();
+
+    virtual ExpressionType getType();
+
+/*
+ * Methods: getId, getArg
+ * Usage: int id = ((CallExp *) exp)->getId();
+ * -------------------------------------------
+ * These methods return the symbol id of the function and the argument
+ * and can be applied only to an object known to be a CallExp.
+ */
+
+    int getId();
+
+    Expression *getArg();
+
+private:
+
+    std::string name;
+    int id;
+    Expression *arg;
 
 };
 
@@ -218,7 +351,10 @@ public:
  * -------------------------------------------------------
  * The constructor initializes a new compound expression
  * which is composed of the operator (op) and the left and
- * right subexpression (lhs and rhs).
+ * right subexpression (lhs and rhs).  For the assignment operator
+ * the target is validated and bound here, once; if lhs is neither a
+ * legal variable nor an array element both subexpressions are freed
+ * and an error is raised.
  */
 
     CompoundExp(std::string op, Expression *lhs, Expression *rhs);
@@ -232,7 +368,7 @@ public:
 
     virtual ~CompoundExp();
 
-    virtual int eval(EvalState &state);
+    virtual Value eval(EvalState &state);
 
     virtual std::string toString();
 
@@ -248,16 +384,267 @@ public:
  * be applied only to an object known to be a CompoundExp.
  */
 
-    std::string getOp();
+    const std::string &getOp();
 
     Expression *getLHS();
 
     Expression *getRHS();
 
+/*
+ * Method: getTarget
+ * Usage: Expression *target = ((CompoundExp *) exp)->getTarget();
+ * ---------------------------------------------------------------
+ * Returns the IdentifierExp or ArrayExp assigned by an assignment node,
+ * or nullptr for any other operator.
+ */
+
+    Expression *getTarget();
+
 private:
 
     std::string op;
     Expression *lhs, *rhs;
+    Expression *target = nullptr;
+
+};
+
+/*
+ * Functions: addValues, subtractValues, multiplyValues, divideValues
+ * Usage: Value sum = addValues(lhs, rhs);
+ * ---------------------------------------
+ * The arithmetic shared by every evaluator.  By default the result wraps
+ * around on overflow, computed in unsigned arithmetic so that it is well
+ * defined.  When the interpreter is built with BASIC_CHECKED_ARITHMETIC
+ * the compiler's overflow builtins are used instead and an overflow is
+ * reported as an error.  divideValues also reports division by zero.
+ */
+
+#ifdef BASIC_CHECKED_ARITHMETIC
+
+inline Value addValues(Value lhs, Value rhs) {
+    Value result;
+    if (__builtin_add_overflow(lhs, rhs, &result)) error("INTEGER OVERFLOW");
+    return result;
+}
+
+inline Value subtractValues(Value lhs, Value rhs) {
+    Value result;
+    if (__builtin_sub_overflow(lhs, rhs, &result)) error("INTEGER OVERFLOW");
+    return result;
+}
+
+inline Value multiplyValues(Value lhs, Value rhs) {
+    Value result;
+    if (__builtin_mul_overflow(lhs, rhs, &result)) error("INTEGER OVERFLOW");
+    return result;
+}
+
+#else
+
+typedef std::make_unsigned<Value>::type UnsignedValue;
+
+inline Value addValues(Value lhs, Value rhs) {
+    return Value(UnsignedValue(lhs) + UnsignedValue(rhs));
+}
+
+inline Value subtractValues(Value lhs, Value rhs) {
+    return Value(UnsignedValue(lhs) - UnsignedValue(rhs));
+}
+
+inline Value multiplyValues(Value lhs, Value rhs) {
+    return Value(UnsignedValue(lhs) * UnsignedValue(rhs));
+}
+
+#endif
+
+inline Value divideValues(Value lhs, Value rhs) {
+    if (rhs == 0) error("DIVIDE BY ZERO");
+    if (rhs == -1) return subtractValues(0, lhs); //the minimum value divided by -1 overflows
+    return lhs / rhs;
+}
+
+/*
+ * Function: stringToValue
+ * Usage: if (stringToValue(str, value)) . . .
+ * -------------------------------------------
+ * Converts an optionally negative decimal integer to a Value.  Returns
+ * false if str is not such an integer or does not fit into a Value.
+ */
+
+bool stringToValue(std::string_view str, Value &value);
+
+/*
+ * Class: CompiledExp
+ * ------------------
+ * This class is the form in which expressions are kept once they have
+ * been parsed.  The Expression tree remains the construction API, but
+ * after parsing it is flattened into a single array of tagged nodes in
+ * postfix order, which eval runs through with a switch loop over a small
+ * fixed value stack.  Evaluating a CompiledExp therefore makes no virtual
+ * calls and builds no strings.
+ */
+
+class CompiledExp {
+
+    friend class ProgramImage;
+
+public:
+
+/*
+ * Constructor: CompiledExp
+ * Usage: CompiledExp compiled(exp);
+ * ---------------------------------
+ * Flattens the expression tree rooted at exp.  The tree is only read,
+ * so the caller still owns it and may delete it afterwards.  The
+ * default constructor creates an empty expression that must not be
+ * evaluated.
+ */
+
+    CompiledExp();
+
+    explicit CompiledExp(Expression *exp);
+
+/*
+ * Method: eval
+ * Usage: Value value = compiled.eval(state);
+ * ----------------------------------------
+ * Evaluates the expression in the context of the specified EvalState,
+ * reporting the same errors as Expression::eval in the same order.
+ */
+
+    Value eval(EvalState &state) const;
+
+/*
+ * Method: isEmpty
+ * Usage: if (compiled.isEmpty()) . . .
+ * ------------------------------------
+ * Returns true for an expression made by the default constructor, which
+ * stands for an optional clause that was left out.
+ */
+
+    bool isEmpty() const;
+
+/*
+ * Methods: isVariable, isElement, getSymbol
+ * Usage: if (compiled.isElement()) . . .
+ * --------------------------------------
+ * Tell whether the expression is a lone variable or a lone array
+ * element, which are the expressions that can be assigned to, and
+ * return the symbol id of that variable or array.
+ */
+
+    bool isVariable() const;
+
+    bool isElement() const;
+
+    int getSymbol() const;
+
+/*
+ * Method: evalIndex
+ * Usage: Value index = compiled.evalIndex(state);
+ * -----------------------------------------------
+ * Evaluates only the index of an expression for which isElement is
+ * true.
+ */
+
+    Value evalIndex(EvalState &state) const;
+
+/*
+ * Method: store
+ * Usage: compiled.store(state, value);
+ * ------------------------------------
+ * Assigns value to the variable or array element the expression
+ * denotes.  The expression must be a variable or an element.
+ */
+
+    void store(EvalState &state, Value value) const;
+
+/*
+ * Method: hasCalls
+ * Usage: if (compiled.hasCalls()) . . .
+ * -------------------------------------
+ * Returns true if the expression calls a function that has not been
+ * inlined.
+ */
+
+    bool hasCalls() const;
+
+/*
+ * Method: inlineCall
+ * Usage: if (compiled.inlineCall(function, param, body)) . . .
+ * ------------------------------------------------------------
+ * Replaces every call of function by a copy of body, the compiled
+ * right-hand side of DEF function(param), and returns true if there was
+ * any.  The argument stays in its stack slot and the body reads param
+ * from there, so it is still evaluated once and before the body.  Only
+ * small bodies that call no function themselves are inlined; for any
+ * other body this returns false and leaves the expression alone.
+ */
+
+    bool inlineCall(int function, int param, const CompiledExp &body);
+
+/*
+ * Methods: assigns, uncheckElements
+ * Usage: if (compiled.assigns(var)) . . .
+ *        if (compiled.uncheckElements(index, arrays)) . . .
+ * -------------------------------------------------------
+ * assigns tells whether the expression assigns to var.  uncheckElements
+ * makes every element access whose index is just the variable index
+ * skip its bounds check, appends the arrays it accesses so to arrays
+ * and returns true if there was any.  It is only applied to the copy of
+ * a FOR loop's body that runs once the loop has checked those arrays
+ * for the whole range of index.
+ */
+
+    bool assigns(int var) const;
+
+    bool uncheckElements(int index, std::vector<int> &arrays);
+
+private:
+
+/*
+ * Type: OpCode
+ * ------------
+ * The tag of each node.  Operands of PUSH_VAR, ASSIGN, PUSH_ELEMENT and
+ * STORE_ELEMENT are symbol ids, the operand of PUSH_CONST is the
+ * constant itself.  PUSH_ELEMENT replaces the index on top of the stack
+ * by the element; STORE_ELEMENT pops the index on top of the stack and
+ * stores the value below it, which is left as the result.  The operand
+ * of AND_THEN and OR_ELSE is the index of the node after the BOOL that
+ * ends their right operand: if the value on top of the stack decides
+ * the result, they leave it there as 0 or 1 and jump; otherwise they
+ * pop it.  Comparisons and BOOL yield 0 or 1.  CALL_FUNCTION replaces
+ * the argument on top of the stack by the result of the function its
+ * operand names.  The last two only appear where a call was inlined:
+ * PUSH_SLOT pushes a copy of the stack slot given by its operand, which
+ * holds the argument, and COLLAPSE pops the result of the body into the
+ * argument's slot.  PUSH_ELEMENT_UNCHECKED and STORE_ELEMENT_UNCHECKED
+ * are PUSH_ELEMENT and STORE_ELEMENT without the bounds check, made by
+ * uncheckElements.
+ */
+
+    enum OpCode : unsigned char {
+        PUSH_CONST, PUSH_VAR, ADD, SUB, MUL, DIV, ASSIGN, PUSH_ELEMENT, STORE_ELEMENT,
+        EQ, NE, LT, GT, LE, GE, AND_THEN, OR_ELSE, BOOL, CALL_FUNCTION, PUSH_SLOT, COLLAPSE,
+        PUSH_ELEMENT_UNCHECKED, STORE_ELEMENT_UNCHECKED
+    };
+
+    struct Node {
+        OpCode op;
+        Value operand;
+    };
+
+    static const int STACK_SIZE = 32;
+    static const size_t INLINE_LIMIT = 32; //largest body inlineCall copies, in nodes
+
+    std::vector<Node> code;
+    int depth = 0;
+
+    int compile(Expression *exp);
+
+    Value run(EvalState &state, size_t count) const;
+
+    static int stackEffect(OpCode op); //along the fall-through path
 
 };
 
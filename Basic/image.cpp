@@ -0,0 +1,632 @@
+/*
+ * File: image.cpp
+ * ---------------
+ * This file implements the image.h interface.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.hpp"
+#include "allocstats.hpp"
+
+const char ProgramImage::MAGIC[8] = {'B', 'A', 'S', 'I', 'C', 'I', 'M', 'G'};
+const char ProgramImage::SNAPSHOT_MAGIC[8] = {'B', 'A', 'S', 'I', 'C', 'S', 'N', 'P'};
+const uint32_t ProgramImage::FORMAT_VERSION = 2;
+const uint32_t ProgramImage::CODE_VERSION = 8; //bump whenever Statement or CompiledExp change shape
+
+/*
+ * Implementation notes: Writer and Reader
+ * ---------------------------------------
+ * Fields are written one at a time in native byte order, so padding
+ * never reaches the file.  Reader checks every access against the end
+ * of its section and raises an error instead of reading past it.
+ */
+
+class ProgramImage::Writer {
+public:
+  std::string buffer;
+
+  template<typename T>
+  void put(T value) {
+    buffer.append((const char *) &value, sizeof(T));
+  }
+
+  void putString(const std::string &str) {
+    put<uint32_t>(str.size());
+    buffer += str;
+  }
+};
+
+class ProgramImage::Reader {
+public:
+  Reader(const char *begin, const char *end) : cur(begin), end(end) {}
+
+  template<typename T>
+  T get() {
+    T value;
+    memcpy(&value, skip(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string getString() {
+    uint32_t length = get<uint32_t>();
+    return std::string(skip(length), length);
+  }
+
+  const char *skip(size_t length) {
+    if (size_t(end - cur) < length) error("LOAD ERROR");
+    const char *ret = cur;
+    cur += length;
+    return ret;
+  }
+
+  bool atEnd() const {
+    return cur == end;
+  }
+
+private:
+  const char *cur, *end;
+};
+
+namespace {
+
+/*
+ * Class: MappedFile
+ * -----------------
+ * Maps a whole file read-only for the lifetime of the object.
+ */
+
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) error("FILE NOT FOUND");
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      data = addr == MAP_FAILED ? nullptr : (const char *) addr;
+    }
+    close(fd);
+    if (size > 0 && data == nullptr) error("FILE NOT FOUND");
+  }
+
+  ~MappedFile() {
+    if (data != nullptr) munmap((void *) data, size);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+uint64_t checksum(const char *data, size_t size) { //FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ (unsigned char) data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+}
+
+void ProgramImage::save(const Program &program, const std::string &filename) {
+  AllocationStats::Scope scope(AllocationStats::IO);
+  std::string image = encode(program);
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(image.data(), image.size());
+  if (!out) error("CANNOT SAVE FILE");
+}
+
+std::string ProgramImage::encode(const Program &program) {
+  Writer source, code;
+  NameTable names;
+  for (auto &line: program.source->lines) {
+    source.put<int32_t>(line.first);
+    source.putString(line.second);
+  }
+  Writer statements;
+  for (auto &line: *program.parsedStatements) {
+    statements.put<int32_t>(line.first);
+    statements.put<uint32_t>(line.second.size());
+    for (auto &stmt: line.second) {
+      writeStatement(statements, stmt, names);
+    }
+  }
+  names.write(code);
+  code.put<uint32_t>(program.parsedStatements->size());
+  code.buffer += statements.buffer;
+
+  Writer image;
+  image.buffer.append(MAGIC, sizeof(MAGIC));
+  image.put<uint32_t>(FORMAT_VERSION);
+  image.put<uint32_t>(BYTE_ORDER_MARK);
+  image.put<uint32_t>(program.source->lines.size());
+  image.put<uint64_t>(source.buffer.size());
+  image.put<uint64_t>(checksum(source.buffer.data(), source.buffer.size()));
+  image.buffer += source.buffer;
+  image.put<uint32_t>(CODE_VERSION);
+  image.put<uint32_t>(sizeof(Value));
+  image.put<uint64_t>(code.buffer.size());
+  image.put<uint64_t>(checksum(code.buffer.data(), code.buffer.size()));
+  image.buffer += code.buffer;
+  return image.buffer;
+}
+
+/*
+ * Implementation notes: load
+ * --------------------------
+ * A damaged source section leaves nothing to fall back on, so it is an
+ * error.  Everything wrong with the code section, including statements
+ * that no longer decode, only means the source has to be parsed again.
+ * The program is not touched until the whole code section has decoded.
+ */
+
+bool ProgramImage::load(Program &program, const std::string &filename, std::vector<std::string> &source) {
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  MappedFile file(filename);
+  if (file.size < sizeof(MAGIC) || memcmp(file.data, MAGIC, sizeof(MAGIC)) != 0) {
+    const char *begin = file.data, *end = file.data + file.size;
+    while (begin < end) {
+      const char *eol = std::find(begin, end, '\n');
+      std::string line(begin, eol);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      source.push_back(line);
+      begin = eol + 1;
+    }
+    return false;
+  }
+  return decode(program, file.data, file.size, source);
+}
+
+bool ProgramImage::decode(Program &program, const char *data, size_t size, std::vector<std::string> &source) {
+  if (size < sizeof(MAGIC) || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) error("LOAD ERROR");
+  Reader image(data + sizeof(MAGIC), data + size);
+  if (image.get<uint32_t>() != FORMAT_VERSION || image.get<uint32_t>() != BYTE_ORDER_MARK) error("LOAD ERROR");
+  uint32_t lineCount = image.get<uint32_t>();
+  uint64_t sourceSize = image.get<uint64_t>();
+  uint64_t sourceChecksum = image.get<uint64_t>();
+  const char *sourceData = image.skip(sourceSize);
+  if (checksum(sourceData, sourceSize) != sourceChecksum) error("LOAD ERROR");
+  std::vector<std::pair<int, std::string>> lines;
+  Reader sourceSection(sourceData, sourceData + sourceSize);
+  for (uint32_t i = 0; i < lineCount; i++) {
+    int lineNumber = sourceSection.get<int32_t>();
+    lines.emplace_back(lineNumber, sourceSection.getString());
+  }
+  if (!sourceSection.atEnd()) error("LOAD ERROR");
+
+  std::vector<std::pair<int, std::vector<Statement>>> statements;
+  try {
+    if (image.get<uint32_t>() != CODE_VERSION || image.get<uint32_t>() != sizeof(Value)) {
+      error("LOAD ERROR");
+    }
+    uint64_t codeSize = image.get<uint64_t>();
+    uint64_t codeChecksum = image.get<uint64_t>();
+    const char *codeData = image.skip(codeSize);
+    if (checksum(codeData, codeSize) != codeChecksum) error("LOAD ERROR");
+    Reader code(codeData, codeData + codeSize);
+    std::vector<int> names = readNames(code);
+    uint32_t parsedCount = code.get<uint32_t>();
+    for (uint32_t i = 0; i < parsedCount; i++) {
+      int lineNumber = code.get<int32_t>();
+      uint32_t statementCount = code.get<uint32_t>();
+      if (statementCount == 0) error("LOAD ERROR");
+      std::vector<Statement> line;
+      for (uint32_t j = 0; j < statementCount; j++) {
+        line.push_back(readStatement(code, names));
+      }
+      statements.emplace_back(lineNumber, std::move(line));
+    }
+    if (!code.atEnd()) error("LOAD ERROR");
+  } catch (ErrorException &ex) {
+    for (auto &line: lines) {
+      source.push_back(line.second);
+    }
+    return false;
+  }
+
+  program.clear();
+  for (auto &line: lines) {
+    program.addSourceLine(line.first, line.second);
+  }
+  for (auto &stmt: statements) {
+    program.setParsedStatements(stmt.first, stmt.second);
+  }
+  return true;
+}
+
+/*
+ * Implementation notes: saveSnapshot, loadSnapshot
+ * ------------------------------------------------
+ * Positions in the run state only mean something for the code the
+ * program links to, so they are written against the linked program and
+ * checked against it again after loading; a suspended run must wait in
+ * an INPUT.  The time limit is stored as the time that was left, which
+ * starts running again when the program is resumed.  The line the
+ * session was processing is stored as text and parsed again.
+ */
+
+void ProgramImage::saveSnapshot(const Session::Snapshot &snapshot, const std::string &filename) {
+  const Program &program = snapshot.program;
+  const EvalState &state = snapshot.state;
+  Writer body;
+  NameTable names;
+  body.put<uint8_t>(snapshot.current.has_value());
+  body.putString(snapshot.current ? snapshot.current->getLine() : "");
+  body.put<uint64_t>(snapshot.next);
+  body.put<uint8_t>(snapshot.finished);
+
+  body.put<uint8_t>(program.suspended);
+  body.put<int32_t>(program.resumeAt);
+  body.put<int64_t>(program.stepLimit);
+  body.put<int64_t>(program.timeLimit.count());
+  body.put<int64_t>(program.stepsLeft);
+  body.put<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      program.deadline - program.suspendedSince).count());
+  body.put<uint32_t>(program.loops.size());
+  for (auto &frame: program.loops) {
+    body.put<uint32_t>(names.index(frame.var));
+    body.put<int64_t>(frame.limit);
+    body.put<int64_t>(frame.step);
+    body.put<int32_t>(frame.body);
+  }
+  body.put<uint32_t>(program.returnDepth);
+  for (int i = 0; i < program.returnDepth; i++) {
+    body.put<int32_t>(program.returns[i]);
+  }
+
+  body.put<uint8_t>(state.waiting);
+  uint32_t count = 0;
+  for (auto &variable: state.variables) {
+    count += variable.defined;
+  }
+  body.put<uint32_t>(count);
+  for (int id = 0; id < int(state.variables.size()); id++) {
+    if (!state.variables[id].defined) continue;
+    body.put<uint32_t>(names.index(id));
+    body.put<int64_t>(state.variables[id].value);
+  }
+  count = std::count_if(state.arrays.begin(), state.arrays.end(), [](auto &array) { return !array.empty(); });
+  body.put<uint32_t>(count);
+  for (int id = 0; id < int(state.arrays.size()); id++) {
+    if (state.arrays[id].empty()) continue;
+    body.put<uint32_t>(names.index(id));
+    body.put<uint32_t>(state.arrays[id].size());
+    for (Value value: state.arrays[id]) {
+      body.put<int64_t>(value);
+    }
+  }
+  count = std::count_if(state.functions.begin(), state.functions.end(),
+                        [](auto &function) { return function.body != nullptr; });
+  body.put<uint32_t>(count);
+  for (int id = 0; id < int(state.functions.size()); id++) {
+    if (state.functions[id].body == nullptr) continue;
+    body.put<uint32_t>(names.index(id));
+    body.put<uint32_t>(names.index(state.functions[id].param));
+    writeExp(body, *state.functions[id].body, names);
+  }
+
+  Writer section;
+  names.write(section);
+  section.buffer += body.buffer;
+  std::string image = encode(program);
+  Writer snapshotFile;
+  snapshotFile.buffer.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  snapshotFile.put<uint32_t>(BYTE_ORDER_MARK);
+  snapshotFile.put<uint32_t>(CODE_VERSION);
+  snapshotFile.put<uint32_t>(sizeof(Value));
+  snapshotFile.put<uint64_t>(image.size());
+  snapshotFile.buffer += image;
+  snapshotFile.put<uint64_t>(section.buffer.size());
+  snapshotFile.put<uint64_t>(checksum(section.buffer.data(), section.buffer.size()));
+  snapshotFile.buffer += section.buffer;
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(snapshotFile.buffer.data(), snapshotFile.buffer.size());
+  if (!out) error("CANNOT SAVE FILE");
+}
+
+Session::Snapshot ProgramImage::loadSnapshot(const std::string &filename) {
+  MappedFile file(filename);
+  if (file.size < sizeof(SNAPSHOT_MAGIC) || memcmp(file.data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+    error("LOAD ERROR");
+  }
+  Reader snapshotFile(file.data + sizeof(SNAPSHOT_MAGIC), file.data + file.size);
+  if (snapshotFile.get<uint32_t>() != BYTE_ORDER_MARK || snapshotFile.get<uint32_t>() != CODE_VERSION || snapshotFile.get<uint32_t>() != sizeof(Value)) {
+    error("LOAD ERROR");
+  }
+  Session::Snapshot snapshot;
+  Program &program = snapshot.program;
+  EvalState &state = snapshot.state;
+  uint64_t imageSize = snapshotFile.get<uint64_t>();
+  std::vector<std::string> source;
+  if (!decode(program, snapshotFile.skip(imageSize), imageSize, source)) error("LOAD ERROR");
+  try {
+    program.link();
+  } catch (ErrorException &ex) {
+    //such a program cannot have been running, so its run state is left over from before and unused
+  }
+  uint64_t sectionSize = snapshotFile.get<uint64_t>();
+  uint64_t sectionChecksum = snapshotFile.get<uint64_t>();
+  const char *sectionData = snapshotFile.skip(sectionSize);
+  if (!snapshotFile.atEnd() || checksum(sectionData, sectionSize) != sectionChecksum) error("LOAD ERROR");
+  Reader in(sectionData, sectionData + sectionSize);
+  std::vector<int> names = readNames(in);
+  auto position = [&](int pos) { //a statement to go on with, or the end
+    if (!program.linked) return 0;
+    if (pos < 0 || pos > int(program.linked->code.size())) error("LOAD ERROR");
+    return program.linked->original(pos); //a copied loop body is only safe when entered from its FOR
+  };
+  auto value = [&]() {
+    int64_t raw = in.get<int64_t>();
+    if (Value(raw) != raw) error("LOAD ERROR");
+    return Value(raw);
+  };
+
+  bool hasCurrent = in.get<uint8_t>();
+  std::string line = in.getString();
+  if (hasCurrent) snapshot.current.emplace(line);
+  snapshot.next = in.get<uint64_t>();
+  snapshot.finished = in.get<uint8_t>();
+
+  program.suspended = in.get<uint8_t>();
+  program.resumeAt = position(in.get<int32_t>());
+  if (program.suspended && (!program.linked || program.resumeAt == program.linked->end
+                            || program.linked->code[program.resumeAt].statement->type->name != "INPUT")) {
+    error("LOAD ERROR");
+  }
+  program.stepLimit = in.get<int64_t>();
+  program.timeLimit = std::chrono::milliseconds(in.get<int64_t>());
+  program.stepsLeft = in.get<int64_t>();
+  if (program.stepLimit < 0 || program.timeLimit.count() < 0 || program.stepsLeft < 0) error("LOAD ERROR");
+  program.suspendedSince = std::chrono::steady_clock::now();
+  program.deadline = program.suspendedSince + std::chrono::milliseconds(in.get<int64_t>());
+  program.loops.resize(in.get<uint32_t>());
+  for (auto &frame: program.loops) {
+    frame.var = readName(in, names);
+    frame.limit = value();
+    frame.step = value();
+    frame.body = position(in.get<int32_t>());
+  }
+  uint32_t returnDepth = in.get<uint32_t>();
+  if (returnDepth > program.returns.size()) error("LOAD ERROR");
+  program.returnDepth = int(returnDepth);
+  for (int i = 0; i < program.returnDepth; i++) {
+    program.returns[i] = position(in.get<int32_t>());
+  }
+
+  state.setWaiting(in.get<uint8_t>());
+  uint32_t count = in.get<uint32_t>();
+  for (uint32_t i = 0; i < count; i++) {
+    int id = readName(in, names);
+    state.setValue(id, value());
+  }
+  count = in.get<uint32_t>();
+  for (uint32_t i = 0; i < count; i++) {
+    int id = readName(in, names);
+    uint32_t size = in.get<uint32_t>();
+    if (size == 0 || size > EvalState::MAX_ARRAY_SIZE) error("LOAD ERROR");
+    state.dimension(id, Value(size - 1));
+    for (Value &element: state.arrays[id]) {
+      element = value();
+    }
+  }
+  count = in.get<uint32_t>();
+  for (uint32_t i = 0; i < count; i++) {
+    int id = readName(in, names);
+    int param = readName(in, names);
+    CompiledExp body;
+    readExp(in, names, body);
+    if (body.isEmpty()) error("LOAD ERROR");
+    state.defineFunction(id, param, body);
+  }
+  if (!in.atEnd()) error("LOAD ERROR");
+  return snapshot;
+}
+
+uint32_t ProgramImage::NameTable::index(int id) {
+  if (id < 0) return NO_NAME;
+  auto it = indices.find(id);
+  if (it != indices.end()) return it->second;
+  names.push_back(id);
+  indices.emplace(id, names.size() - 1);
+  return names.size() - 1;
+}
+
+void ProgramImage::NameTable::write(Writer &out) const {
+  out.put<uint32_t>(names.size());
+  for (int id: names) {
+    out.putString(std::string(Symbols::name(id)));
+  }
+}
+
+std::vector<int> ProgramImage::readNames(Reader &in) {
+  std::vector<int> names(in.get<uint32_t>()); //symbol id of each name table entry
+  for (int &id: names) {
+    id = Symbols::intern(in.getString());
+  }
+  return names;
+}
+
+int ProgramImage::readName(Reader &in, const std::vector<int> &names, bool optional) {
+  uint32_t index = in.get<uint32_t>();
+  if (optional && index == NO_NAME) return -1;
+  if (index >= names.size()) error("LOAD ERROR");
+  return names[index];
+}
+
+void ProgramImage::writeExp(Writer &out, const CompiledExp &exp, NameTable &names) {
+  out.put<int32_t>(exp.depth);
+  out.put<uint32_t>(exp.code.size());
+  for (auto &node: exp.code) {
+    bool named = node.op == CompiledExp::PUSH_VAR || node.op == CompiledExp::ASSIGN
+                 || node.op == CompiledExp::PUSH_ELEMENT || node.op == CompiledExp::STORE_ELEMENT
+                 || node.op == CompiledExp::CALL_FUNCTION;
+    out.put<uint8_t>(node.op);
+    out.put<int64_t>(named ? names.index(node.operand) : node.operand);
+  }
+}
+
+void ProgramImage::writeStatement(Writer &out, const Statement &stmt, NameTable &names) {
+  out.putString(stmt.type->name);
+  out.put<uint32_t>(stmt.args.size());
+  for (auto &arg: stmt.args) {
+    out.putString(arg);
+  }
+  out.put<uint8_t>(stmt.fusion);
+  out.put<uint32_t>(names.index(stmt.var));
+  out.put<uint32_t>(names.index(stmt.param));
+  out.put<int64_t>(stmt.constant);
+  out.put<uint8_t>(stmt.cmp);
+  out.put<int32_t>(stmt.target);
+  out.put<uint32_t>(stmt.lines.size());
+  for (int line: stmt.lines) {
+    out.put<int32_t>(line);
+  }
+  for (auto *exps: {&stmt.exps, &stmt.targets}) {
+    out.put<uint32_t>(exps->size());
+    for (auto &exp: *exps) {
+      writeExp(out, exp, names);
+    }
+  }
+}
+
+/*
+ * Implementation notes: readStatement, readExp
+ * --------------------------------------------
+ * Besides decoding, this validates everything execute relies on: the
+ * statement type must exist and get the right number of arguments, all
+ * indices must be in range, each expression that is not a left-out
+ * optional clause must leave exactly one value on a stack no deeper
+ * than its recorded depth, every jump must go forward to a node that
+ * is reached with the same stack height either way, and each target
+ * must be a variable or an element.  Name table indices are translated
+ * back into the symbol ids of this process.
+ */
+
+Statement ProgramImage::readStatement(Reader &in, const std::vector<int> &names) {
+  Statement stmt(StatementType::get(in.getString()));
+  stmt.args.resize(in.get<uint32_t>());
+  for (auto &arg: stmt.args) {
+    arg = in.getString();
+  }
+  uint8_t fusion = in.get<uint8_t>();
+  if (fusion > Statement::NEXT) error("LOAD ERROR");
+  stmt.fusion = Statement::Fusion(fusion);
+  stmt.var = readName(in, names, true);
+  stmt.param = readName(in, names, true);
+  bool isDef = stmt.type->name == "DEF";
+  bool needsVar = stmt.fusion == Statement::INCREMENT || stmt.fusion == Statement::BRANCH
+                  || stmt.fusion == Statement::NEXT || stmt.type->name == "FOR" || isDef;
+  if ((needsVar && stmt.var < 0) || (isDef && stmt.param < 0)) {
+    error("LOAD ERROR");
+  }
+  int64_t constant = in.get<int64_t>();
+  stmt.constant = Value(constant);
+  if (stmt.constant != constant) error("LOAD ERROR");
+  stmt.cmp = char(in.get<uint8_t>());
+  stmt.target = in.get<int32_t>();
+  uint32_t lineCount = in.get<uint32_t>();
+  for (uint32_t i = 0; i < lineCount; i++) {
+    stmt.lines.push_back(in.get<int32_t>());
+  }
+
+  for (auto *exps: {&stmt.exps, &stmt.targets}) {
+    exps->resize(in.get<uint32_t>());
+    for (auto &exp: *exps) {
+      readExp(in, names, exp);
+    }
+  }
+  if (stmt.exps.size() != stmt.type->expArgs.size() || stmt.targets.size() != stmt.type->targetArgs.size()
+      || stmt.args.size() != stmt.type->predicates.size() + 1) {
+    error("LOAD ERROR");
+  }
+  for (auto &target: stmt.targets) {
+    if (!target.isVariable() && !target.isElement()) error("LOAD ERROR");
+  }
+  if (isDef && stmt.exps[0].isEmpty()) error("LOAD ERROR"); //the body callFunction runs
+  if (isDef) stmt.function = std::make_shared<const CompiledExp>(stmt.exps[0]);
+  return stmt;
+}
+
+void ProgramImage::readExp(Reader &in, const std::vector<int> &names, CompiledExp &exp) {
+  exp.depth = in.get<int32_t>();
+  exp.code.resize(in.get<uint32_t>());
+  int height = 0, maxHeight = 0;
+  std::vector<int> joins(exp.code.size() + 1, -1); //height a jump arrives with at each node
+  for (size_t i = 0; i < exp.code.size(); i++) {
+    auto &node = exp.code[i];
+    if (joins[i] >= 0 && joins[i] != height) error("LOAD ERROR");
+    uint8_t op = in.get<uint8_t>();
+    int64_t operand = in.get<int64_t>();
+    node.op = CompiledExp::OpCode(op);
+    node.operand = Value(operand);
+    if (node.operand != operand) error("LOAD ERROR");
+    auto name = [&]() -> int {
+      if (uint64_t(operand) >= names.size()) error("LOAD ERROR");
+      return names[operand];
+    };
+    switch (node.op) {
+      case CompiledExp::PUSH_VAR:
+        node.operand = name();
+        /* fall through */
+      case CompiledExp::PUSH_CONST:
+        height++;
+        break;
+      case CompiledExp::ASSIGN:
+      case CompiledExp::PUSH_ELEMENT:
+      case CompiledExp::CALL_FUNCTION:
+        if (height < 1) error("LOAD ERROR");
+        node.operand = name();
+        break;
+      case CompiledExp::STORE_ELEMENT:
+        node.operand = name();
+        /* fall through */
+      case CompiledExp::ADD:
+      case CompiledExp::SUB:
+      case CompiledExp::MUL:
+      case CompiledExp::DIV:
+      case CompiledExp::EQ:
+      case CompiledExp::NE:
+      case CompiledExp::LT:
+      case CompiledExp::GT:
+      case CompiledExp::LE:
+      case CompiledExp::GE:
+        if (height < 2) error("LOAD ERROR");
+        height--;
+        break;
+      case CompiledExp::AND_THEN:
+      case CompiledExp::OR_ELSE:
+        if (height < 1 || operand <= int64_t(i) || operand > int64_t(exp.code.size())) error("LOAD ERROR");
+        if (joins[operand] >= 0 && joins[operand] != height) error("LOAD ERROR");
+        joins[operand] = height;
+        height--;
+        break;
+      case CompiledExp::BOOL:
+        if (height < 1) error("LOAD ERROR");
+        break;
+      case CompiledExp::PUSH_SLOT:
+        if (operand < 0 || operand >= height) error("LOAD ERROR");
+        height++;
+        break;
+      case CompiledExp::COLLAPSE:
+        if (height < 2) error("LOAD ERROR");
+        height--;
+        break;
+      default:
+        error("LOAD ERROR");
+    }
+    maxHeight = std::max(maxHeight, height);
+  }
+  if (joins.back() >= 0 && joins.back() != height) error("LOAD ERROR");
+  if (exp.code.empty() ? exp.depth != 0 : height != 1 || maxHeight != exp.depth) error("LOAD ERROR");
+}
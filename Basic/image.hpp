@@ -0,0 +1,133 @@
+/*
+ * File: image.h
+ * -------------
+ * This interface exports the ProgramImage class, which stores a parsed
+ * program on disk as a binary image so that it can be loaded again
+ * without running its source through the parser.
+ */
+
+#ifndef _image_h
+#define _image_h
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "program.hpp"
+#include "session.hpp"
+
+/*
+ * Class: ProgramImage
+ * -------------------
+ * An image is one contiguous file without pointers, so it is read
+ * straight out of an mmap'd region.  It is written in the byte order of
+ * the machine that saved it, which the header records right after the
+ * format version; a machine with the other byte order refuses to load
+ * it.  It has two sections:
+ *
+ * 1. The source section, holding every line number and source line.
+ *    Its layout is fixed by FORMAT_VERSION.
+ *
+ * 2. The code section, holding the variable name table and, for each
+ *    line, its typed statements with their compiled expressions.  Symbol
+ *    ids differ between processes, so the code refers to variables by
+ *    their index in the name table.  Its layout is fixed by CODE_VERSION
+ *    and the size of Value.
+ *
+ * Each section carries its own length and checksum.  If the code
+ * section does not match this build of the interpreter, the program is
+ * rebuilt by parsing the source section instead.
+ *
+ * A snapshot file holds the image of a session's program followed by a
+ * state section, behind a header of its own with the byte order, with
+ * the run state of the program, the variables,
+ * arrays and functions, and the line the session was processing.  Its
+ * layout is fixed by CODE_VERSION as well, and positions in the program
+ * refer to the code the image links to.
+ */
+
+class ProgramImage {
+
+public:
+
+/*
+ * Method: save
+ * Usage: ProgramImage::save(program, filename);
+ * ---------------------------------------------
+ * Writes the image of program to filename.
+ */
+
+  static void save(const Program &program, const std::string &filename);
+
+/*
+ * Method: load
+ * Usage: if (ProgramImage::load(program, filename, source)) . . .
+ * ---------------------------------------------------------------
+ * Replaces program by the one stored in filename and returns true.  If
+ * the file is not a valid image for this build, program is left alone,
+ * the source lines to parse instead are stored in source, and false is
+ * returned; a file that is not an image at all is read as source text.
+ */
+
+  static bool load(Program &program, const std::string &filename, std::vector<std::string> &source);
+
+/*
+ * Methods: saveSnapshot, loadSnapshot
+ * Usage: ProgramImage::saveSnapshot(session.snapshot(), filename);
+ *        session.restore(ProgramImage::loadSnapshot(filename));
+ * ----------------------------------------------------------------
+ * Write a snapshot of a session to filename, and read one back.  Unlike
+ * a program image, a snapshot cannot fall back on the source, so one
+ * that does not match this build raises an error.
+ */
+
+  static void saveSnapshot(const Session::Snapshot &snapshot, const std::string &filename);
+
+  static Session::Snapshot loadSnapshot(const std::string &filename);
+
+private:
+
+  static const char MAGIC[8];
+  static const char SNAPSHOT_MAGIC[8];
+  static const uint32_t FORMAT_VERSION;
+  static const uint32_t CODE_VERSION;
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304; //reads differently with the other byte order
+  static const uint32_t NO_NAME = UINT32_MAX; //name table index for no variable
+
+  class Writer;
+  class Reader;
+
+  /*
+   * Collects the variables a section refers to, in the order of its name
+   * table.  index returns NO_NAME for -1.
+   */
+  class NameTable {
+  public:
+    uint32_t index(int id);
+
+    void write(Writer &out) const;
+
+  private:
+    std::vector<int> names; //symbol ids
+    std::unordered_map<int, uint32_t> indices;
+  };
+
+  static std::string encode(const Program &program);
+
+  static bool decode(Program &program, const char *data, size_t size, std::vector<std::string> &source);
+
+  static std::vector<int> readNames(Reader &in);
+
+  static int readName(Reader &in, const std::vector<int> &names, bool optional = false);
+
+  static void writeExp(Writer &out, const CompiledExp &exp, NameTable &names);
+
+  static void readExp(Reader &in, const std::vector<int> &names, CompiledExp &exp);
+
+  static void writeStatement(Writer &out, const Statement &stmt, NameTable &names);
+
+  static Statement readStatement(Reader &in, const std::vector<int> &names);
+
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * File: linereader.cpp
+ * --------------------
+ * This file implements the linereader.h interface.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include "linereader.hpp"
+#include "allocstats.hpp"
+
+LineReader::LineReader(int fd, std::ostream *tie) {
+  this->fd = fd;
+  this->tie = tie;
+  buffer = new char[capacity];
+}
+
+LineReader::~LineReader() {
+  delete[] buffer;
+}
+
+bool LineReader::readLine(std::string_view &line) {
+  while (true) {
+    char *newline = (char *) memchr(buffer + scanned, '\n', end - scanned);
+    if (newline != nullptr) {
+      line = std::string_view(buffer + begin, newline - buffer - begin);
+      begin = scanned = newline - buffer + 1;
+      return true;
+    }
+    scanned = end;
+    if (!fill()) {
+      if (begin == end) return false;
+      line = std::string_view(buffer + begin, end - begin);
+      begin = scanned = end;
+      return true;
+    }
+  }
+}
+
+/*
+ * Implementation notes: fill
+ * --------------------------
+ * Moves the partial line to the front of the buffer, doubling the buffer
+ * first if the partial line already fills it, and reads one more chunk
+ * behind it.  Returns false at the end of the input.
+ */
+
+bool LineReader::fill() {
+  AllocationStats::Scope scope(AllocationStats::IO);
+  if (eof) return false;
+  if (begin > 0) {
+    memmove(buffer, buffer + begin, end - begin);
+    end -= begin;
+    scanned -= begin;
+    begin = 0;
+  }
+  if (end == capacity) {
+    char *grown = new char[capacity * 2];
+    memcpy(grown, buffer, end);
+    delete[] buffer;
+    buffer = grown;
+    capacity *= 2;
+  }
+  if (tie != nullptr) tie->flush();
+  while (waitReadable()) {
+    ssize_t count = read(fd, buffer + end, capacity - end);
+    if (count > 0) {
+      end += count;
+      return true;
+    }
+    if (count < 0 && errno == EINTR) continue;
+    break;
+  }
+  eof = true;
+  return false;
+}
+
+void LineReader::setCancel(const std::atomic<bool> *flag) {
+  cancel = flag;
+}
+
+bool LineReader::waitReadable() { //false once cancelled
+  if (cancel == nullptr) return true;
+  pollfd request{fd, POLLIN, 0};
+  while (!*cancel) {
+    int ready = poll(&request, 1, 50);
+    if (ready > 0 || (ready < 0 && errno != EINTR)) return true; //readable, closed or failed: read tells which
+  }
+  return false;
+}
+
+LineReader &LineReader::standardInput() {
+  static LineReader reader(STDIN_FILENO, &std::cout);
+  return reader;
+}
+
+StringReader::StringReader(std::string text) : text(std::move(text)) {
+}
+
+bool StringReader::readLine(std::string_view &line) {
+  if (begin >= text.size()) return false;
+  size_t newline = text.find('\n', begin);
+  if (newline == std::string::npos) newline = text.size();
+  line = std::string_view(text).substr(begin, newline - begin);
+  begin = newline + 1;
+  return true;
+}
+
+void LineQueue::feed(std::string_view data) {
+  AllocationStats::Scope scope(AllocationStats::IO);
+  std::lock_guard<std::mutex> guard(lock);
+  this->data.append(data);
+}
+
+void LineQueue::close() {
+  std::lock_guard<std::mutex> guard(lock);
+  closed = true;
+}
+
+bool LineQueue::hasLine() {
+  std::lock_guard<std::mutex> guard(lock);
+  return closed || data.find('\n', begin) != std::string::npos;
+}
+
+bool LineQueue::readLine(std::string_view &line) {
+  return tryReadLine(line) == READY;
+}
+
+LineSource::Status LineQueue::tryReadLine(std::string_view &line) {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t newline = data.find('\n', begin);
+  if (newline == std::string::npos) {
+    if (!closed) return PENDING;
+    if (begin >= data.size()) return END;
+    newline = data.size();
+  }
+  this->line.assign(data, begin, newline - begin);
+  begin = newline + 1;
+  if (begin >= data.size() / 2) { //reclaim the lines read, without moving data for every one
+    data.erase(0, std::min(begin, data.size()));
+    begin = 0;
+  }
+  line = this->line;
+  return READY;
+}
@@ -0,0 +1,197 @@
+/*
+ * File: linereader.h
+ * ------------------
+ * This interface exports the LineReader class, which splits an input
+ * stream into lines for the command loop and for INPUT statements, the
+ * StringReader class, which does the same for a script in memory, and
+ * the LineQueue class, which is fed by its owner and never blocks.
+ */
+
+#ifndef _linereader_h
+#define _linereader_h
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/*
+ * Class: LineSource
+ * -----------------
+ * The interface of anything the command loop and INPUT statements take
+ * lines from.  readLine stores the next line, without its newline, in
+ * line and returns true, or returns false once the input is exhausted.
+ * The view is valid until the next call.  tryReadLine does the same
+ * without waiting: it returns PENDING if the next line has not arrived
+ * yet, which only sources that are fed from outside ever do.
+ */
+
+class LineSource {
+
+public:
+
+  enum Status {
+    READY, PENDING, END
+  };
+
+  virtual ~LineSource() = default;
+
+  virtual bool readLine(std::string_view &line) = 0;
+
+  virtual Status tryReadLine(std::string_view &line) {
+    return readLine(line) ? READY : END;
+  }
+
+};
+
+/*
+ * Class: LineReader
+ * -----------------
+ * Reads a file descriptor in large chunks into one buffer and hands out
+ * the lines in it as views into that buffer, so no line is copied and
+ * a long script costs one system call per chunk rather than per line.
+ * Consumed bytes are reclaimed by moving the unread tail to the front
+ * of the buffer before the next chunk is read, so a line is always
+ * contiguous; the buffer only grows for lines longer than itself.
+ */
+
+class LineReader : public LineSource {
+
+public:
+
+/*
+ * Constructor: LineReader
+ * Usage: LineReader reader(fd, &std::cout);
+ * -----------------------------------------
+ * Creates a reader for the file descriptor fd.  If tie is not null, it
+ * is flushed before every read that may block, so that prompts written
+ * to it are visible before the reader waits for input.
+ */
+
+  explicit LineReader(int fd, std::ostream *tie = nullptr);
+
+  ~LineReader() override;
+
+  LineReader(const LineReader &) = delete;
+
+  LineReader &operator=(const LineReader &) = delete;
+
+/*
+ * Method: readLine
+ * Usage: if (reader.readLine(line)) . . .
+ * ---------------------------------------
+ * Implements LineSource::readLine.  A last line without a newline is
+ * still returned.
+ */
+
+  bool readLine(std::string_view &line) override;
+
+/*
+ * Method: setCancel
+ * Usage: reader.setCancel(&flag);
+ * -------------------------------
+ * Makes the reader wait for input in short slices and behave as if the
+ * input had ended as soon as flag is set, so that a thread blocked on
+ * the reader can be stopped.
+ */
+
+  void setCancel(const std::atomic<bool> *flag);
+
+/*
+ * Method: standardInput
+ * Usage: LineReader &input = LineReader::standardInput();
+ * -------------------------------------------------------
+ * Returns the reader for standard input, tied to std::cout.
+ */
+
+  static LineReader &standardInput();
+
+private:
+
+  static const size_t CHUNK_SIZE = 1 << 16;
+
+  int fd;
+  std::ostream *tie;
+  const std::atomic<bool> *cancel = nullptr;
+  char *buffer;
+  size_t capacity = CHUNK_SIZE;
+  size_t begin = 0; //first unread byte
+  size_t scanned = 0; //bytes before this hold no newline
+  size_t end = 0; //end of the data read so far
+  bool eof = false;
+
+  bool fill();
+
+  bool waitReadable();
+
+};
+
+/*
+ * Class: StringReader
+ * -------------------
+ * A LineSource over a script held in memory, for sessions that are not
+ * fed from a file descriptor.  Like LineReader, it hands out views into
+ * its own copy of the text.
+ */
+
+class StringReader : public LineSource {
+
+public:
+
+  explicit StringReader(std::string text);
+
+  bool readLine(std::string_view &line) override;
+
+private:
+
+  std::string text;
+  size_t begin = 0; //first unread character
+
+};
+
+/*
+ * Class: LineQueue
+ * ----------------
+ * A LineSource that its owner feeds with data as it arrives, for hosts
+ * that drive many sessions from one thread and must never block on one
+ * of them.  feed and close may be called from another thread than the
+ * one reading.  tryReadLine returns PENDING while no complete line is
+ * queued and the queue is still open, and readLine treats that like
+ * the end of the input.  A last line without a newline is returned once
+ * the queue is closed.
+ */
+
+class LineQueue : public LineSource {
+
+public:
+
+  void feed(std::string_view data);
+
+  void close();
+
+/*
+ * Method: hasLine
+ * Usage: if (queue.hasLine()) . . .
+ * ---------------------------------
+ * Returns true if tryReadLine would not return PENDING.
+ */
+
+  bool hasLine();
+
+  bool readLine(std::string_view &line) override;
+
+  Status tryReadLine(std::string_view &line) override;
+
+private:
+
+  std::mutex lock;
+  std::string data; //fed data, guarded by lock like begin and closed
+  size_t begin = 0; //first character not yet read
+  bool closed = false;
+  std::string line; //the line handed out last, only touched by the reader
+
+};
+
+#endif
@@ -11,14 +11,18 @@
  * Implementation notes: parseExp
  * ------------------------------
  * This code just reads an expression and then checks for extra tokens.
+ * The string form parses into a tree, flattens it with compileExp and
+ * frees the tree again before anything is evaluated.
  */
-int parseExp(const std::string &str, EvalState &state) {
-  TokenScanner scanner;
-  scanner.ignoreWhitespace();
-  scanner.setInput(str);
-  Expression *expression = parseExp(scanner);
+Value parseExp(const std::string &str, EvalState &state) {
+  return compileExp(str).eval(state);
+}
+
+namespace {
+
+CompiledExp flatten(Expression *expression) { //and free the tree
   try {
-    int ret = expression->eval(state);
+    CompiledExp ret(expression);
     delete expression;
     return ret;
   } catch (ErrorException &ex) {
@@ -27,8 +31,27 @@ int parseExp(const std::string &str, EvalState &state) {
   }
 }
 
-Expression *parseExp(TokenScanner &scanner) {
-  Expression *exp = readE(scanner);
+}
+
+CompiledExp compileExp(const std::string &str) {
+  TokenScanner scanner;
+  scanner.ignoreWhitespace();
+  scanner.setInput(str);
+  return flatten(parseExp(scanner));
+}
+
+CompiledExp compileCondition(const std::string &str) {
+  TokenScanner scanner;
+  scanner.ignoreWhitespace();
+  scanner.addOperator("<=");
+  scanner.addOperator(">=");
+  scanner.addOperator("<>");
+  scanner.setInput(str);
+  return flatten(parseExp(scanner, true));
+}
+
+Expression *parseExp(TokenScanner &scanner, bool condition) {
+  Expression *exp = readE(scanner, 0, condition);
   if (scanner.hasMoreTokens()) {
     error("parseExp: Found extra token: " + scanner.nextToken());
   }
@@ -44,17 +67,19 @@ Expression *parseExp(TokenScanner &scanner) {
  * subexpressions until it finds an operator whose precedence is greater
  * than the prevailing one.  When a higher-precedence operator is found,
  * readE calls itself recursively to read in that subexpression as a unit.
+ * In a condition the = token is the equality operator "==".
  */
 
-Expression *readE(TokenScanner &scanner, int prec) {
-  Expression *exp = readT(scanner);
+Expression *readE(TokenScanner &scanner, int prec, bool condition) {
+  Expression *exp = readT(scanner, condition);
   std::string token;
   while (true) {
     token = scanner.nextToken();
-    int newPrec = precedence(token);
+    std::string op = condition && token == "=" ? "==" : token;
+    int newPrec = precedence(op, condition);
     if (newPrec <= prec) break;
-    Expression *rhs = readE(scanner, newPrec);
-    exp = new CompoundExp(token, exp, rhs);
+    Expression *rhs = readE(scanner, newPrec, condition);
+    exp = new CompoundExp(op, exp, rhs);
   }
   scanner.saveToken(token);
   return exp;
@@ -64,17 +89,44 @@ Expression *readE(TokenScanner &scanner, int prec) {
  * Implementation notes: readT
  * ---------------------------
  * This function scans a term, which is either an integer, an identifier,
- * or a parenthesized subexpression.
+ * an array element, a function call or a parenthesized subexpression.
+ * An identifier directly followed by a parenthesis names an array
+ * element, or calls a function if it begins with FN.  Unary
+ * minus applies to everything up to the next comparison or boolean
+ * operator, and in a condition NOT x is read as x == 0, applying to
+ * everything up to the next AND or OR.
  */
 
-Expression *readT(TokenScanner &scanner) {
+Expression *readT(TokenScanner &scanner, bool condition) {
   std::string token = scanner.nextToken();
   TokenType type = scanner.getTokenType(token);
-  if (type == WORD) return new IdentifierExp(token);
-  if (type == NUMBER) return new ConstantExp(stringToInteger(token));
-  if (token == "-") return new CompoundExp(token, new ConstantExp(0), readE(scanner));
+  if (condition && token == "NOT") {
+    return new CompoundExp("==", readE(scanner, 4, true), new ConstantExp(0));
+  }
+  if (type == WORD) {
+    std::string next = scanner.nextToken();
+    if (next != "(") {
+      scanner.saveToken(next);
+      return new IdentifierExp(token);
+    }
+    Expression *index = readE(scanner, 0, condition);
+    if (scanner.nextToken() != ")") {
+      delete index;
+      error("Unbalanced parentheses in expression");
+    }
+    if (token.size() > 2 && token.compare(0, 2, "FN") == 0) return new CallExp(token, index);
+    return new ArrayExp(token, index);
+  }
+  if (type == NUMBER) {
+    Value value;
+    if (!stringToValue(token, value)) error("stringToInteger: Illegal integer format (" + token + ")");
+    return new ConstantExp(value);
+  }
+  if (token == "-") {
+    return new CompoundExp(token, new ConstantExp(0), readE(scanner, precedence("==", true), condition));
+  }
   if (token != "(") error("Illegal term in expression");
-  Expression *exp = readE(scanner);
+  Expression *exp = readE(scanner, 0, condition);
   if (scanner.nextToken() != ")") {
     error("Unbalanced parentheses in expression");
   }
@@ -88,9 +140,15 @@ Expression *readT(TokenScanner &scanner) {
  * and returns the appropriate precedence value.
  */
 
-int precedence(std::string token) {
+int precedence(std::string token, bool condition) {
   if (token == "=") return 1;
-  if (token == "+" || token == "-") return 2;
-  if (token == "*" || token == "/") return 3;
+  if (condition) {
+    if (token == "OR") return 2;
+    if (token == "AND") return 3;
+    //4 is NOT, see readT
+    if (token == "==" || token == "<>" || token == "<" || token == ">" || token == "<=" || token == ">=") return 5;
+  }
+  if (token == "+" || token == "-") return 6;
+  if (token == "*" || token == "/") return 7;
   return 0;
 }
@@ -25,9 +25,33 @@
  * whitespace and to scan numbers.
  */
 
-int parseExp(const std::string &str, EvalState &state);
+Value parseExp(const std::string &str, EvalState &state);
 
-Expression *parseExp(TokenScanner &scanner);
+/*
+ * Function: compileExp
+ * Usage: CompiledExp exp = compileExp(str);
+ * -----------------------------------------
+ * Parses the expression in str and flattens it into a CompiledExp, so
+ * that it can be evaluated any number of times without being parsed
+ * again.  Syntax errors are reported here rather than on evaluation.
+ */
+
+CompiledExp compileExp(const std::string &str);
+
+/*
+ * Function: compileCondition
+ * Usage: CompiledExp condition = compileCondition(str);
+ * -----------------------------------------------------
+ * Like compileExp, but parses str as a condition, in which = compares
+ * instead of assigning and the comparison operators <, >, <=, >=, <>
+ * and the boolean operators AND, OR and NOT are available.  Comparisons
+ * yield 1 or 0, and AND and OR only evaluate their right operand when
+ * the left one does not already decide the result.
+ */
+
+CompiledExp compileCondition(const std::string &str);
+
+Expression *parseExp(TokenScanner &scanner, bool condition = false);
 
 /*
  * Function: readE
@@ -36,9 +60,11 @@ Expression *parseExp(TokenScanner &scanner);
  * Returns the next expression from the scanner involving only operators
  * whose precedence is at least prec.  The prec argument is optional and
  * defaults to 0, which means that the function reads the entire expression.
+ * If condition is true, the expression is read as a condition (see
+ * compileCondition).
  */
 
-Expression *readE(TokenScanner &scanner, int prec = 0);
+Expression *readE(TokenScanner &scanner, int prec = 0, bool condition = false);
 
 /*
  * Function: readT
@@ -48,16 +74,18 @@ Expression *readE(TokenScanner &scanner, int prec = 0);
  * identifier, or a parenthesized subexpression.
  */
 
-Expression *readT(TokenScanner &scanner);
+Expression *readT(TokenScanner &scanner, bool condition = false);
 
 /*
  * Function: precedence
  * Usage: int prec = precedence(token);
  * ------------------------------------
  * Returns the precedence of the specified operator token.  If the token
- * is not an operator, precedence returns 0.
+ * is not an operator, precedence returns 0.  The comparison and boolean
+ * operators only have a precedence in conditions; there the equality
+ * operator is spelled "==".
  */
 
-int precedence(std::string token);
+int precedence(std::string token, bool condition = false);
 
 #endif
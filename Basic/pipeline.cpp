@@ -0,0 +1,72 @@
+/*
+ * File: pipeline.cpp
+ * ------------------
+ * This file implements the pipeline.h interface.
+ */
+
+#include <chrono>
+#include "pipeline.hpp"
+
+namespace {
+
+/*
+ * Function: backOff
+ * -----------------
+ * Waits a little longer on every call while a side of the queue has
+ * nothing to do, so an idle pipeline does not keep a core busy.
+ */
+
+void backOff(int &rounds) {
+  if (rounds < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(rounds < 1024 ? 20 : 500));
+  }
+  rounds++;
+}
+
+}
+
+Pipeline::Pipeline(int fd) : reader(fd), queue(CAPACITY) {
+  reader.setCancel(&stopped);
+  thread = std::thread(&Pipeline::produce, this);
+}
+
+Pipeline::~Pipeline() {
+  stopped = true;
+  thread.join();
+}
+
+void Pipeline::produce() {
+  std::string_view line;
+  while (reader.readLine(line)) {
+    std::optional<ParsedLine> parsed(std::in_place, std::string(line));
+    int rounds = 0;
+    while (!queue.tryPush(std::move(parsed))) {
+      if (stopped) return;
+      backOff(rounds);
+    }
+  }
+  finished.store(true, std::memory_order_release);
+}
+
+bool Pipeline::pop(std::optional<ParsedLine> &line) {
+  int rounds = 0;
+  while (!queue.tryPop(line)) {
+    if (finished.load(std::memory_order_acquire)) {
+      return queue.tryPop(line); //the last line may have been pushed just before finishing
+    }
+    backOff(rounds);
+  }
+  return true;
+}
+
+const ParsedLine *Pipeline::next() {
+  return pop(current) ? &*current : nullptr;
+}
+
+bool Pipeline::readLine(std::string_view &line) {
+  if (!pop(input)) return false;
+  line = input->getLine();
+  return true;
+}
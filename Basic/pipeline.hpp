@@ -0,0 +1,122 @@
+/*
+ * File: pipeline.h
+ * ----------------
+ * This interface exports the Pipeline class, which parses piped input on
+ * a reader thread while the main thread executes the lines parsed so far.
+ */
+
+#ifndef _pipeline_h
+#define _pipeline_h
+
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "linereader.hpp"
+#include "statement.hpp"
+
+/*
+ * Class: SpscQueue
+ * ----------------
+ * A bounded lock-free queue for exactly one producer thread and one
+ * consumer thread.  The capacity must be a power of two.  tryPush only
+ * moves from value if it succeeds.
+ */
+
+template<typename T>
+class SpscQueue {
+
+public:
+
+  explicit SpscQueue(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+
+  bool tryPush(T &&value) {
+    size_t back = tail.load(std::memory_order_relaxed);
+    if (back - head.load(std::memory_order_acquire) == slots.size()) return false;
+    slots[back & mask] = std::move(value);
+    tail.store(back + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T &value) {
+    size_t front = head.load(std::memory_order_relaxed);
+    if (front == tail.load(std::memory_order_acquire)) return false;
+    value = std::move(slots[front & mask]);
+    slots[front & mask] = T();
+    head.store(front + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+
+  std::vector<T> slots;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+
+};
+
+/*
+ * Class: Pipeline
+ * ---------------
+ * Reads lines from a file descriptor on its own thread, parses each into
+ * a ParsedLine and hands them to the main thread through an SpscQueue,
+ * so that parsing overlaps with execution.  The pipeline is also the
+ * LineSource for INPUT statements: readLine takes the next queued line
+ * and returns its text, so INPUT reads from exactly where the command
+ * loop stopped and the parse done for that line is simply dropped.
+ */
+
+class Pipeline : public LineSource {
+
+public:
+
+/*
+ * Constructor: Pipeline
+ * Usage: Pipeline pipeline(fd);
+ * -----------------------------
+ * Starts the reader thread on fd.
+ */
+
+  explicit Pipeline(int fd);
+
+/*
+ * Destructor: ~Pipeline
+ * ---------------------
+ * Stops the reader thread, even if it is waiting for more input, and
+ * waits for it to finish.
+ */
+
+  ~Pipeline() override;
+
+/*
+ * Method: next
+ * Usage: const ParsedLine *line = pipeline.next();
+ * ------------------------------------------------
+ * Returns the next parsed line, or nullptr at the end of the input.  The
+ * line stays valid until the next call.
+ */
+
+  const ParsedLine *next();
+
+  bool readLine(std::string_view &line) override;
+
+private:
+
+  static const size_t CAPACITY = 1024;
+
+  LineReader reader;
+  SpscQueue<std::optional<ParsedLine>> queue;
+  std::atomic<bool> finished{false};
+  std::atomic<bool> stopped{false};
+  std::optional<ParsedLine> current; //returned by next
+  std::optional<ParsedLine> input; //returned by readLine
+  std::thread thread;
+
+  void produce();
+
+  bool pop(std::optional<ParsedLine> &line);
+
+};
+
+#endif
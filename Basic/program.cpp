@@ -1,81 +1,514 @@
 /*
  * File: program.cpp
  * -----------------
- * This file is a stub implementation of the program.h interface
- * in which none of the methods do anything beyond returning a
- * value of the correct type.  Your job is to fill in the bodies
- * of each of these methods with an implementation that satisfies
- * the performance guarantees specified in the assignment.
+ * This file implements the program.h interface: the source lines and
+ * their statements, the linker that lays them out as code with resolved
+ * jumps, inlined functions and bounds-checked loop copies, and the run
+ * loop with its FOR/NEXT and GOSUB/RETURN state and the step and time
+ * limits.
  */
 
+#include <algorithm>
+#include <climits>
+#include <limits>
 #include "program.hpp"
+#include "allocstats.hpp"
 
-Program::Program() = default;
+Program::Program() : source(std::make_shared<Source>()), parsedStatements(std::make_shared<Lines>()) {
+}
 
 Program::~Program() = default;
 
 void Program::clear() {
-  sourceLines.clear();
-  parsedStatements.clear();
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  source = std::make_shared<Source>(); //rather than copying what is about to be cleared
+  editStatements().clear();
 }
 
 void Program::addSourceLine(int lineNumber, const std::string &line) {
-  sourceLines.erase(lineNumber); //have to erase first
-  sourceLines.insert({lineNumber, line});
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  Source &source = editSource();
+  source.lines.erase(lineNumber); //have to erase first
+  source.lines.insert({lineNumber, line});
+  if (source.listingValid && (source.listed.empty() || source.listed.back().first < lineNumber)) {
+    source.listed.emplace_back(lineNumber, source.listing.size());
+    source.listing += line;
+    source.listing += '\n';
+  } else {
+    source.listingValid = false;
+  }
 }
 
-void Program::setParsedStatement(int lineNumber, const Statement &stmt) {
-  parsedStatements.erase(lineNumber); //have to erase first
-  parsedStatements.insert({lineNumber, stmt});
+void Program::setParsedStatements(int lineNumber, const std::vector<Statement> &statements) {
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  Lines &lines = editStatements();
+  lines.erase(lineNumber); //have to erase first
+  lines.insert({lineNumber, statements});
 }
 
 void Program::remove(int lineNumber) {
-  sourceLines.erase(lineNumber);
-  parsedStatements.erase(lineNumber);
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  if (source->lines.count(lineNumber) > 0) {
+    Source &source = editSource();
+    source.lines.erase(lineNumber);
+    if (source.listingValid && source.listed.back().first == lineNumber) {
+      source.listing.resize(source.listed.back().second);
+      source.listed.pop_back();
+    } else {
+      source.listingValid = false;
+    }
+  }
+  if (parsedStatements->count(lineNumber) > 0) editStatements().erase(lineNumber);
 }
 
-void Program::print() {
-  for(auto & sourceLine : sourceLines) {
-    std::cout << sourceLine.second << std::endl;
+Program::Source &Program::editSource() {
+  if (source.use_count() > 1) {
+    source = std::make_shared<Source>(*source); //leave the copies' lines alone
   }
+  return *source;
 }
 
-void Program::nextLine() { //make sure that currentLine is valid or = -1, find next valid or = -1
-  if(parsedStatements.empty()) {
-    currentLine = -1;
-    return;
+Program::Lines &Program::editStatements() {
+  if (parsedStatements.use_count() > 1) {
+    parsedStatements = std::make_shared<Lines>(*parsedStatements); //leave the copies' statements alone
   }
-  if (currentLine == -1) {
-    currentLine = parsedStatements.begin()->first;
-    return;
+  linked.reset();
+  return *parsedStatements;
+}
+
+/*
+ * Implementation notes: print, renderListing
+ * ------------------------------------------
+ * Lines are usually entered, and always loaded, in ascending order, so
+ * the listing is kept up to date by appending to it, and by cutting off
+ * the last line when that is removed.  Any other change leaves it to be
+ * rendered again by the next LIST, in one pass.  A range is then a
+ * contiguous slice of the listing, found by binary search.
+ */
+
+void Program::print(std::ostream &out) {
+  print(out, INT_MIN, INT_MAX);
+}
+
+void Program::print(std::ostream &out, int first, int last) {
+  AllocationStats::Scope scope(AllocationStats::IO);
+  if (!source->listingValid) renderListing();
+  const std::string &listing = source->listing;
+  const auto &listed = source->listed;
+  auto offset = [&](int line, bool after) { //of the first line numbered above line, or at least line
+    auto it = std::lower_bound(listed.begin(), listed.end(), line, [after](const std::pair<int, size_t> &entry, int line) {
+      return after ? entry.first <= line : entry.first < line;
+    });
+    return it == listed.end() ? listing.size() : it->second;
+  };
+  size_t begin = offset(first, false), end = offset(last, true);
+  if (begin < end) out.write(listing.data() + begin, std::streamsize(end - begin));
+}
+
+void Program::renderListing() {
+  Source &source = editSource(); //a copy may be listing the shared one
+  source.listing.clear();
+  source.listed.clear();
+  for (auto &sourceLine: source.lines) {
+    source.listed.emplace_back(sourceLine.first, source.listing.size());
+    source.listing += sourceLine.second;
+    source.listing += '\n';
   }
-  auto it = parsedStatements.find(currentLine); //must find!
-  it++;
-  currentLine = (it == parsedStatements.end()) ? -1 : it->first;
+  source.listingValid = true;
 }
 
-void Program::run(EvalState& state) { //currentLine still would be -1
-  currentLine = -1; //may return with error, so we have to reset
-  nextLine();
-  while(currentLine != -1) {
-    at().execute(state, *this);
-    if(!lineModified) {
-      nextLine();
+/*
+ * Implementation notes: link
+ * --------------------------
+ * The statements stay in parsedStatements and code only points at them,
+ * so any change to the program unlinks it and the next RUN links again.
+ * Copies of a program share its statements, along with the code that
+ * points at them, until one of the copies is changed.
+ * A function with exactly one DEF in the program is inlined here: a
+ * statement calling it is copied into copies with the body inlined,
+ * and code points at the copy instead, so the original can be linked
+ * again against a different DEF later.  Which DEF defines a function
+ * is only known at run time, as it may not have run yet, may have been
+ * skipped, or the function may have been defined by an immediate DEF,
+ * so the copy only runs while every function it inlined is defined by
+ * exactly the DEF it was inlined from, and the original, which calls
+ * them, runs otherwise.
+ * A FOR without a NEXT is reported here, before the program starts, as
+ * a run could otherwise only tell when the loop is first skipped.
+ * Last, every FOR loop whose variable only its own NEXT can change gets
+ * a second copy of its body appended to code, after a stop mark at end,
+ * with the element accesses indexed by the variable unchecked; see
+ * hoistChecks.
+ */
+
+void Program::link() {
+  AllocationStats::Scope scope(AllocationStats::PROGRAM);
+  auto result = std::make_shared<Linked>(); //a copy of the program may still run the old one
+  auto &code = result->code;
+  auto &jumpTables = result->jumpTables;
+  std::unordered_map<int, const Statement *> functions; //null if defined more than once
+  for (auto &line: *parsedStatements) {
+    for (auto &stmt: line.second) {
+      code.push_back({&stmt, line.first, -1, -1, -1, -1});
+      if (stmt.type->name == "DEF") {
+        auto result = functions.insert({stmt.var, &stmt});
+        if (!result.second) result.first->second = nullptr;
+      }
+    }
+  }
+  int end = result->end = int(code.size());
+  if (!functions.empty()) {
+    for (auto &ins: code) {
+      ins.statement = inlineCalls(*ins.statement, functions, result->copies);
+    }
+  }
+  for (int i = 0; i < end; i++) {
+    const Statement &stmt = *code[i].statement;
+    if (stmt.type->name == "FOR") {
+      code[i].target = result->matchingNext(i);
+      if (code[i].target < 0) error("FOR WITHOUT NEXT");
+    } else if (stmt.target >= 0) {
+      code[i].target = result->position(stmt.target);
+    }
+    if (!stmt.lines.empty()) {
+      code[i].table = int(jumpTables.size());
+      for (int line: stmt.lines) {
+        jumpTables.push_back(line >= 0 ? result->position(line) : -1);
+      }
+    }
+  }
+  code.push_back({nullptr, INT_MAX, -1, -1, -1, -1}); //never run, as a run stops when it gets there
+  result->copiedFrom.push_back(end);
+  for (int i = end - 1; i >= 0; i--) { //inner loops first, where most of the time goes
+    if (code[i].statement->type->name == "FOR") result->hoistChecks(i);
+  }
+  linked = std::move(result);
+}
+
+/*
+ * Implementation notes: hoistChecks
+ * ---------------------------------
+ * The copy of a loop's body is only entered from its FOR, by way of the
+ * frame's body, once beginLoop has checked every array the copy indexes
+ * by the loop variable against the whole range from the start to the
+ * limit.  It is left through its NEXT, which goes on after the original
+ * NEXT.  Within the copy the variable can only be changed by that NEXT,
+ * which keeps it in the range, and no array can be dimensioned again.
+ * So the body must not assign the variable, start a loop over it, run
+ * DIM, call a function (its body might assign the variable, and an
+ * inlined call falls back to a real one), or leave the copy for a place
+ * that could change it and come back: no GOSUB, RETURN or ON, and IF
+ * and GOTO may only jump within the body or back to the FOR.  DEF
+ * bodies are left checked, as they may be called anywhere later.
+ */
+
+void Program::Linked::hoistChecks(int pos) {
+  int var = code[pos].statement->var;
+  int exit = code[pos].target; //after the NEXT
+  if (exit < 0) return;
+  std::vector<int> arrays;
+  std::vector<std::pair<int, Statement>> changed; //positions and copies of the statements with unchecked accesses
+  for (int i = pos + 1; i < exit - 1; i++) {
+    const Statement &stmt = *code[i].statement;
+    const std::string &name = stmt.type->name;
+    if (name == "DIM" || name == "GOSUB" || name == "RETURN" || name == "ON") return;
+    if (name == "FOR" && stmt.var == var) return;
+    if ((name == "IF" || name == "GOTO") && code[i].target >= 0 && (code[i].target < pos || code[i].target >= exit)) {
+      return;
+    }
+    for (auto &exp: stmt.targets) {
+      if (exp.isVariable() && exp.getSymbol() == var) return;
+    }
+    auto unsafe = [var](const CompiledExp &exp) { return exp.hasCalls() || exp.assigns(var); };
+    if (std::any_of(stmt.exps.begin(), stmt.exps.end(), unsafe) ||
+        std::any_of(stmt.targets.begin(), stmt.targets.end(), unsafe)) {
+      return;
+    }
+    if (name == "DEF") continue;
+    if (stmt.fusion == Statement::INLINED) return; //it falls back to calls when the DEF has not run
+    Statement copy = stmt;
+    bool unchecked = false;
+    for (auto &exp: copy.exps) {
+      unchecked |= exp.uncheckElements(var, arrays);
+    }
+    for (auto &exp: copy.targets) {
+      unchecked |= exp.uncheckElements(var, arrays);
+    }
+    if (unchecked) changed.emplace_back(i, std::move(copy));
+  }
+  if (changed.empty()) return;
+
+  std::sort(arrays.begin(), arrays.end());
+  arrays.erase(std::unique(arrays.begin(), arrays.end()), arrays.end());
+  code[pos].checks = int(checkedArrays.size());
+  checkedArrays.push_back(int(arrays.size()));
+  checkedArrays.insert(checkedArrays.end(), arrays.begin(), arrays.end());
+  int fast = int(code.size());
+  code[pos].fast = fast;
+  auto next = changed.begin();
+  for (int i = pos + 1; i < exit; i++) {
+    Instruction ins = code[i];
+    if (next != changed.end() && next->first == i) {
+      copies.push_back(std::move(next->second));
+      ins.statement = &copies.back();
+      ++next;
+    }
+    if (i == exit - 1) {
+      ins.target = exit;
+    } else if (ins.target > pos) {
+      ins.target += fast - (pos + 1);
+    }
+    code.push_back(ins);
+    copiedFrom.push_back(i);
+  }
+}
+
+bool Program::Linked::inBounds(const Instruction &ins, Value low, Value high, Value step,
+                               const EvalState &state) const {
+  if (low < 0 || step > std::numeric_limits<Value>::max() - high) return false; //NEXT must not wrap around
+  const int *arrays = checkedArrays.data() + ins.checks;
+  for (int i = 1; i <= arrays[0]; i++) {
+    if (state.getArraySize(arrays[i]) <= high) return false;
+  }
+  return true;
+}
+
+int Program::Linked::original(int pos) const {
+  return pos < end ? pos : size_t(pos) < code.size() ? copiedFrom[pos - end] : end;
+}
+
+const Statement *Program::inlineCalls(const Statement &stmt,
+                                      const std::unordered_map<int, const Statement *> &functions,
+                                      std::deque<Statement> &copies) {
+  auto calls = [](const CompiledExp &exp) { return exp.hasCalls(); };
+  if (stmt.fusion != Statement::NONE || stmt.type->name == "DEF" ||
+      (std::none_of(stmt.exps.begin(), stmt.exps.end(), calls) &&
+       std::none_of(stmt.targets.begin(), stmt.targets.end(), calls))) {
+    return &stmt;
+  }
+  Statement copy = stmt;
+  for (auto &function: functions) {
+    if (function.second == nullptr) continue;
+    const Statement &def = *function.second;
+    bool changed = false;
+    for (auto &exp: copy.exps) {
+      changed |= exp.inlineCall(def.var, def.param, def.exps[0]);
+    }
+    for (auto &exp: copy.targets) {
+      changed |= exp.inlineCall(def.var, def.param, def.exps[0]);
+    }
+    if (changed) copy.inlinedDefs.emplace_back(def.var, def.function.get());
+  }
+  if (copy.inlinedDefs.empty()) return &stmt;
+  copy.fusion = Statement::INLINED;
+  copy.original = &stmt;
+  copies.push_back(std::move(copy));
+  return &copies.back();
+}
+
+int Program::Linked::position(int line) const { //of the first statement of line, or -1
+  auto last = code.begin() + end;
+  auto it = std::lower_bound(code.begin(), last, line, [](const Instruction &ins, int line) {
+    return ins.line < line;
+  });
+  return it != last && it->line == line ? int(it - code.begin()) : -1;
+}
+
+int Program::Linked::matchingNext(int pos) const { //the position after it, or -1
+  int var = code[pos].statement->var;
+  int depth = 0;
+  for (int i = pos + 1; i < end; i++) {
+    const Statement &stmt = *code[i].statement;
+    if (stmt.var != var) continue;
+    if (stmt.type->name == "FOR") {
+      depth++;
+    } else if (stmt.type->name == "NEXT" && depth-- == 0) {
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Implementation notes: run, execute
+ * ----------------------------------
+ * The loop only counts down to the next check of the limits, so a run
+ * without limits pays one decrement per statement.  checkLimits is
+ * called before the statement that finds the countdown at zero and
+ * returns the next one, which ends exactly where the step limit does.
+ * suspend ends the loop the way END does, by moving pc to end, so
+ * the loop needs no test of its own for it; the steps left over in the
+ * countdown are handed back for the next resume.  The loop is compiled
+ * once with and once without recording into the trace, so a run that
+ * is not traced does not even test whether it should be.
+ */
+
+void Program::run(EvalState &state) {
+  if (!linked) {
+    link();
+    state.getCounters().links++;
+  }
+  loops.clear();
+  returnDepth = 0;
+  lineModified = false;
+  suspended = false;
+  pc = 0;
+  stepsLeft = stepLimit;
+  deadline = std::chrono::steady_clock::now() + timeLimit;
+  execute(state);
+}
+
+void Program::resume(EvalState &state) {
+  if (!suspended) return;
+  suspended = false;
+  pc = resumeAt;
+  deadline += std::chrono::steady_clock::now() - suspendedSince;
+  execute(state);
+}
+
+bool Program::isSuspended() const {
+  return suspended;
+}
+
+void Program::suspend() {
+  if (!running) return;
+  suspended = true;
+  resumeAt = pc;
+  suspendedSince = std::chrono::steady_clock::now();
+  pc = linked->end;
+  lineModified = true;
+}
+
+void Program::execute(EvalState &state) {
+  AllocationStats::Scope scope(AllocationStats::EVALUATOR);
+  running = true;
+  int countdown;
+  try {
+    countdown = trace.isOn() ? executeLoop<true>(state) : executeLoop<false>(state);
+  } catch (...) {
+    running = false;
+    throw;
+  }
+  running = false;
+  if (suspended && stepLimit > 0) stepsLeft += std::max(countdown, 0);
+}
+
+template<bool TRACED>
+int Program::executeLoop(EvalState &state) {
+  int countdown = 0; //statements that may run after this one before the limits are checked again
+  uint64_t &jumps = state.getCounters().jumps;
+  const Linked &current = *linked; //a run never relinks
+  while (pc != current.end) {
+    if (countdown-- == 0) countdown = checkLimits();
+    const Instruction &ins = current.code[pc];
+    if (TRACED) trace.record(ins.line, ins.statement->type);
+    ins.statement->execute(state, *this);
+    if (!lineModified) {
+      pc++;
     } else {
       lineModified = false; //reset
+      jumps++;
     }
   }
+  return countdown;
+}
+
+void Program::setLimits(long long steps, std::chrono::milliseconds time) {
+  stepLimit = steps;
+  timeLimit = time;
+}
+
+Trace &Program::getTrace() {
+  return trace;
+}
+
+int Program::checkLimits() {
+  if (timeLimit.count() > 0 && std::chrono::steady_clock::now() > deadline) error("TIME LIMIT EXCEEDED");
+  if (stepLimit == 0) return CHECK_INTERVAL - 1;
+  if (stepsLeft == 0) error("STEP LIMIT EXCEEDED");
+  int countdown = int(std::min<long long>(stepsLeft, CHECK_INTERVAL));
+  stepsLeft -= countdown;
+  return countdown - 1;
 }
 
 void Program::setCurrentLine(int line) {
-  currentLine = line;
+  if (line == -1) {
+    pc = linked->end;
+  } else {
+    pc = linked->position(line);
+    if (pc < 0) error("LINE NUMBER ERROR");
+  }
+  lineModified = true;
+}
+
+void Program::branch() {
+  int target = linked->code[pc].target;
+  if (target < 0) error("LINE NUMBER ERROR");
+  pc = target;
+  lineModified = true;
+}
+
+void Program::branchOn(Value index) {
+  const Instruction &ins = linked->code[pc];
+  if (index < 1 || size_t(index) > ins.statement->lines.size()) return;
+  int target = linked->jumpTables[ins.table + index - 1];
+  if (target < 0) error("LINE NUMBER ERROR");
+  pc = target;
+  lineModified = true;
+}
+
+void Program::beginLoop(int var, Value limit, Value step, EvalState &state) {
+  for (int i = int(loops.size()) - 1; i >= 0; i--) {
+    if (loops[i].var == var) {
+      loops.resize(i);
+      break;
+    }
+  }
+  Value value = state.getValue(var);
+  if (step >= 0 ? value <= limit : value >= limit) {
+    const Instruction &ins = linked->code[pc];
+    if (ins.fast >= 0 && linked->inBounds(ins, std::min(value, limit), std::max(value, limit), step, state)) {
+      loops.push_back({var, limit, step, ins.fast});
+      pc = ins.fast;
+      lineModified = true;
+    } else {
+      loops.push_back({var, limit, step, pc + 1});
+    }
+    return;
+  }
+  pc = linked->code[pc].target;
   lineModified = true;
 }
 
-const Statement &Program::at() {
-  auto it = parsedStatements.find(currentLine);
-  if (it == parsedStatements.end()) {
-    error("LINE NUMBER ERROR");
+void Program::endLoop(int var, EvalState &state) {
+  int i = int(loops.size()) - 1;
+  while (i >= 0 && loops[i].var != var) i--;
+  if (i < 0) error("NEXT WITHOUT FOR");
+  loops.resize(i + 1);
+  LoopFrame &frame = loops.back();
+  Value value = addValues(state.getValue(var), frame.step);
+  state.setValue(var, value);
+  if (frame.step >= 0 ? value <= frame.limit : value >= frame.limit) {
+    pc = frame.body;
+    lineModified = true;
+  } else {
+    loops.pop_back();
+    if (linked->code[pc].target >= 0) { //the NEXT of a copied body goes on after the original
+      pc = linked->code[pc].target;
+      lineModified = true;
+    }
   }
-  return it->second;
+}
+
+void Program::gosub() {
+  if (size_t(returnDepth) == returns.size()) error("GOSUB STACK OVERFLOW");
+  int next = pc + 1;
+  branch();
+  returns[returnDepth++] = next;
+}
+
+void Program::returnFromGosub() {
+  if (returnDepth == 0) error("RETURN WITHOUT GOSUB");
+  pc = returns[--returnDepth];
+  lineModified = true;
 }
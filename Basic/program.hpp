@@ -10,13 +10,47 @@
 
 #include <string>
 #include <vector>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include "statement.hpp"
+#include "trace.hpp"
 
 
 class Statement;
 
+/*
+ * Constant: BASIC_GOSUB_DEPTH
+ * ---------------------------
+ * How many GOSUBs may be active at once.  Set it with the CMake cache
+ * variable of the same name.
+ */
+
+#ifndef BASIC_GOSUB_DEPTH
+#define BASIC_GOSUB_DEPTH 256
+#endif
+
+/*
+ * Constants: BASIC_STEP_LIMIT, BASIC_TIME_LIMIT_MS
+ * ------------------------------------------------
+ * How many statements a RUN may execute and how many milliseconds it
+ * may take before it is aborted, 0 for no limit.  These are the
+ * defaults of every Program; set them with the CMake cache variables of
+ * the same name.
+ */
+
+#ifndef BASIC_STEP_LIMIT
+#define BASIC_STEP_LIMIT 0
+#endif
+
+#ifndef BASIC_TIME_LIMIT_MS
+#define BASIC_TIME_LIMIT_MS 0
+#endif
+
 /*
  * This class stores the lines in a BASIC program.  Each line
  * in the program is stored in order according to its line number.
@@ -26,20 +60,223 @@ class Statement;
  * 1. The source line, which is the complete line (including the
  *    line number) that was entered by the user.
  *
- * 2. The parsed representation of that statement, which is a
- *    pointer to a Statement.
+ * 2. The parsed representation of that line, which holds one
+ *    Statement for each of its colon-separated statements.
+ *
+ * Copies of a program share both, and the code RUN links them into,
+ * until one of the copies is changed, so copying a program only copies
+ * the state of its run.
  */
 
 class Program {
-  std::map<int, std::string> sourceLines;
-  std::map<int, Statement> parsedStatements;
-  int currentLine = -1; //should be -1 when not running, or should be a valid line number
+  friend class ProgramImage;
+
+  /*
+   * RUN first links the program: the statements are laid out in line
+   * order in code, those of one line next to each other, and every
+   * branch is resolved to the position it continues at, so running
+   * never looks a line number up again.
+   */
+  struct Instruction {
+    const Statement *statement;
+    int line;
+    int target; //position of the IF/GOTO/GOSUB line or of the statement after a FOR's NEXT, -1 if none
+    int table; //where the positions of an ON's lines start in jumpTables
+    int fast; //start of the copy of a FOR's body that skips bounds checks, -1 if none
+    int checks; //where the number and ids of the arrays that copy indexes start in checkedArrays
+  };
+
+  /*
+   * An active FOR loop, with its limit and step evaluated once when the
+   * loop is entered.
+   */
+  struct LoopFrame {
+    int var;
+    Value limit;
+    Value step;
+    int body; //position of the first statement of the body
+  };
+
+  /*
+   * The source lines, and a listing of them that LIST prints slices of.
+   */
+  struct Source {
+    std::map<int, std::string> lines;
+    std::string listing; //the lines in order, each ending in a newline, while listingValid
+    std::vector<std::pair<int, size_t>> listed; //number and offset in listing of each line, while listingValid
+    bool listingValid = true;
+  };
+
+  typedef std::map<int, std::vector<Statement>> Lines;
+
+  /*
+   * What link makes of the statements.  It is never changed once built,
+   * only dropped when the program changes, so copies of a program share
+   * it and run the same code at once.
+   */
+  struct Linked {
+    std::vector<Instruction> code;
+    std::vector<int> jumpTables; //positions of the lines of every ON, -1 where there is no such line
+    std::vector<int> checkedArrays; //see Instruction::checks
+    std::vector<int> copiedFrom; //position of the original of each statement in code from end on
+    int end = 0; //number of statements of the program, code[end] stops a run and the copies of loop bodies follow
+    std::deque<Statement> copies; //statements with DEF bodies inlined or bounds checks hoisted
+
+    int position(int line) const;
+    int matchingNext(int pos) const;
+    void hoistChecks(int pos);
+    bool inBounds(const Instruction &ins, Value low, Value high, Value step, const EvalState &state) const;
+    int original(int pos) const; //of a copied statement, pos itself for others
+  };
+
+  std::shared_ptr<Source> source; //shared with copies of the program, see editSource
+  std::shared_ptr<Lines> parsedStatements; //shared with copies of the program, see editStatements
+  std::shared_ptr<const Linked> linked; //null while the program has changed since it was linked
+  std::vector<LoopFrame> loops;
+  std::array<int, BASIC_GOSUB_DEPTH> returns; //positions to RETURN to, the first returnDepth are in use
+  int returnDepth = 0;
+  int pc = 0; //position of the statement being run
   bool lineModified = false;
-  void nextLine();
-  const Statement& at();
+  long long stepLimit = BASIC_STEP_LIMIT; //0 for none
+  std::chrono::milliseconds timeLimit{BASIC_TIME_LIMIT_MS}; //0 for none
+  long long stepsLeft = 0; //of the step limit, not counting the current countdown
+  std::chrono::steady_clock::time_point deadline;
+  bool running = false; //inside execute
+  bool suspended = false;
+  int resumeAt = 0; //position of the INPUT a suspended run waits in
+  std::chrono::steady_clock::time_point suspendedSince;
+  Trace trace; //not copied with the program
+  static const int CHECK_INTERVAL = 4096; //statements run between two looks at the clock
+  static const Statement *inlineCalls(const Statement &stmt,
+                                     const std::unordered_map<int, const Statement *> &functions,
+                                     std::deque<Statement> &copies);
+  Source &editSource(); //stops sharing the source lines
+  Lines &editStatements(); //unlinks the program and stops sharing its statements
+  void renderListing();
+  int checkLimits();
+  void execute(EvalState &state);
+  template<bool TRACED>
+  int executeLoop(EvalState &state); //returns the countdown it stopped at
 public:
+
+/*
+ * Method: run
+ * Usage: program.run(state);
+ * --------------------------
+ * Runs the program from its first line, linking it first if it has
+ * changed.  A run that exceeds the step or time limit is aborted with an
+ * error; the program and state can be run again afterwards.
+ */
+
   void run(EvalState &state);
+
+/*
+ * Method: link
+ * Usage: program.link();
+ * ----------------------
+ * Links the program ahead of its next RUN, so that the copies made of
+ * it from now on share the linked code instead of linking their own.
+ * Raises an error if a FOR has no NEXT, which RUN then reports without
+ * running anything.
+ */
+
+  void link();
+
+/*
+ * Methods: suspend, resume, isSuspended
+ * Usage: program.suspend();
+ *        if (program.isSuspended()) program.resume(state);
+ * ----------------------------------------------------------
+ * An INPUT whose line has not arrived yet calls suspend, which makes the
+ * run return right after that statement without advancing past it;
+ * outside a run, suspend does nothing.  resume carries on with the same
+ * INPUT, so a waiting program holds no thread.  Time spent suspended
+ * does not count against the time limit.
+ */
+
+  void suspend();
+
+  void resume(EvalState &state);
+
+  bool isSuspended() const;
+
+/*
+ * Method: setLimits
+ * Usage: program.setLimits(steps, time);
+ * --------------------------------------
+ * Sets how many statements each later RUN may execute and how long it
+ * may take, 0 for no limit.  Both are checked together every few
+ * thousand statements, so a run may overshoot the time limit by that
+ * much, but the step limit is exact.
+ */
+
+  void setLimits(long long steps, std::chrono::milliseconds time);
+
+/*
+ * Method: getTrace
+ * Usage: program.getTrace().start();
+ * ----------------------------------
+ * Returns the trace every RUN records the statements it runs into while
+ * the trace is on.
+ */
+
+  Trace &getTrace();
+
   void setCurrentLine(int line);
+
+/*
+ * Method: branch
+ * Usage: program.branch();
+ * ------------------------
+ * Continues the run at the line the IF or GOTO being run names, which
+ * was resolved when the program was linked.
+ */
+
+  void branch();
+
+/*
+ * Method: branchOn
+ * Usage: program.branchOn(index);
+ * -------------------------------
+ * Continues the run at the index-th line (counting from 1) of the ON
+ * being run, looked up in a table resolved when the program was
+ * linked.  If there is no index-th line, the run goes on with the next
+ * statement.
+ */
+
+  void branchOn(Value index);
+
+/*
+ * Methods: beginLoop, endLoop
+ * Usage: program.beginLoop(var, limit, step, state);
+ *        program.endLoop(var, state);
+ * ---------------------------------------------------
+ * Run FOR and NEXT.  beginLoop is called once var holds its start value.
+ * It enters the loop if that value is within limit, and otherwise skips
+ * past the matching NEXT.  endLoop adds the step to var and jumps back
+ * to the start of the body until var passes the limit.  A loop started
+ * again for the same variable replaces the running one, and NEXT
+ * leaves any loops nested inside its own.
+ */
+
+  void beginLoop(int var, Value limit, Value step, EvalState &state);
+
+  void endLoop(int var, EvalState &state);
+
+/*
+ * Methods: gosub, returnFromGosub
+ * Usage: program.gosub();
+ *        program.returnFromGosub();
+ * ---------------------------------
+ * Run GOSUB and RETURN.  gosub saves the position after the GOSUB being
+ * run and branches like GOTO; returnFromGosub continues at the position
+ * saved last.  Both raise an error instead of overflowing or
+ * underflowing the return stack.
+ */
+
+  void gosub();
+
+  void returnFromGosub();
   /*
  * Constructor: Program
  * Usage: Program program;
@@ -66,7 +303,19 @@ public:
  */
 
     void clear();
-    void print();
+
+/*
+ * Method: print
+ * Usage: program.print(out);
+ *        program.print(out, first, last);
+ * ---------------------------------------
+ * Writes the source lines of the program to out in line order, or only
+ * those numbered first through last, with a single write.
+ */
+
+    void print(std::ostream &out);
+
+    void print(std::ostream &out, int first, int last);
 
 /*
  * Method: addSourceLine
@@ -94,15 +343,15 @@ public:
     void remove(int lineNumber);
 
 /*
- * Method: setParsedStatement
- * Usage: program.setParsedStatement(lineNumber, stmt);
- * ----------------------------------------------------
- * Adds the parsed representation of the statement to the statement
- * at the specified line number.  If no such line exists, this
- * method raises an error.  If a previous parsed representation
- * exists, the memory for that statement is reclaimed.
+ * Method: setParsedStatements
+ * Usage: program.setParsedStatements(lineNumber, statements);
+ * -----------------------------------------------------------
+ * Sets the parsed representation of the line with the specified
+ * line number to statements, in the order they are run.  If a
+ * previous parsed representation exists, the memory for it is
+ * reclaimed.
  */
-    void setParsedStatement(int lineNumber, const Statement &stmt);
+    void setParsedStatements(int lineNumber, const std::vector<Statement> &statements);
 };
 
 #endif
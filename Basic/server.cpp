@@ -0,0 +1,398 @@
+/*
+ * File: server.cpp
+ * ----------------
+ * This file implements the server.h interface.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <streambuf>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.hpp"
+#include "session.hpp"
+#include "Utils/error.hpp"
+
+namespace {
+
+/*
+ * An output buffer for a connected socket, which is non-blocking, so a
+ * client that stops reading cannot hold up the worker that prints for
+ * it.  What the socket does not take at once is kept in unsent and
+ * sent by the polling thread once the socket is writable again; the
+ * first bytes kept are announced through wakeFd so that it starts
+ * polling for that.  If more than MAX_UNSENT bytes pile up, or the
+ * client has gone away, the rest of the output is dropped.  send is
+ * used instead of write so that a vanished client cannot kill the
+ * server with SIGPIPE.
+ */
+class SocketBuffer : public std::streambuf {
+
+public:
+
+  SocketBuffer(int fd, int wakeFd) : fd(fd), wakeFd(wakeFd) {
+    setp(buffer, buffer + sizeof(buffer));
+  }
+
+  ~SocketBuffer() override {
+    sync();
+  }
+
+  bool hasUnsent() {
+    std::lock_guard<std::mutex> guard(lock);
+    return !unsent.empty();
+  }
+
+  void sendUnsent() {
+    std::lock_guard<std::mutex> guard(lock);
+    const char *data = unsent.data();
+    size_t left = unsent.size();
+    sendSome(data, left);
+    unsent.erase(0, unsent.size() - left);
+  }
+
+protected:
+
+  int overflow(int ch) override {
+    if (sync() != 0) return traits_type::eof();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  int sync() override {
+    const char *data = pbase();
+    size_t left = pptr() - pbase();
+    setp(buffer, buffer + sizeof(buffer));
+    std::lock_guard<std::mutex> guard(lock);
+    if (unsent.empty()) sendSome(data, left); //otherwise it has to wait its turn
+    if (broken) return -1;
+    if (left == 0) return 0;
+    if (unsent.size() + left > MAX_UNSENT) {
+      broken = true;
+      unsent.clear();
+      return -1;
+    }
+    if (unsent.empty()) {
+      char wake = 0;
+      (void) !write(wakeFd, &wake, 1);
+    }
+    unsent.append(data, left);
+    return 0;
+  }
+
+private:
+
+  static const size_t MAX_UNSENT = 1 << 22;
+
+  int fd;
+  int wakeFd;
+  char buffer[1 << 12];
+  std::mutex lock;
+  std::string unsent; //guarded by lock
+  bool broken = false; //guarded by lock, set once the output is being dropped
+
+  void sendSome(const char *&data, size_t &left) { //as much as the socket takes now
+    while (left > 0 && !broken) {
+      ssize_t count = send(fd, data, left, MSG_NOSIGNAL);
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+        broken = true;
+        unsent.clear();
+        return;
+      }
+      data += count;
+      left -= count;
+    }
+  }
+
+};
+
+/*
+ * Owns a file descriptor and closes it when it goes out of scope.
+ */
+struct Socket {
+  explicit Socket(int fd) : fd(fd) {}
+
+  ~Socket() {
+    if (fd >= 0) close(fd);
+  }
+
+  Socket(const Socket &) = delete;
+
+  Socket &operator=(const Socket &) = delete;
+
+  int fd;
+};
+
+void socketError() { //raises the error
+  error(std::string("SOCKET ERROR: ") + strerror(errno));
+}
+
+}
+
+Server::Server(unsigned threads) {
+  if (threads == 0) threads = 1;
+  for (unsigned i = 0; i < threads; i++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  for (unsigned i = 0; i < threads; i++) {
+    this->threads.emplace_back(&Server::work, this, i);
+  }
+}
+
+Server::~Server() {
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &thread: threads) {
+    thread.join();
+  }
+  for (int fd: wakeFds) {
+    if (fd >= 0) close(fd); //only now that no job can write to it any more
+  }
+}
+
+void Server::setLimits(long long steps, std::chrono::milliseconds time) {
+  stepLimit = steps;
+  timeLimit = time;
+}
+
+std::future<std::string> Server::submit(std::string script) {
+  auto task = std::make_shared<std::packaged_task<std::string()>>(
+      [script = std::move(script), steps = stepLimit, time = timeLimit]() {
+        StringReader input(script);
+        std::ostringstream output;
+        Session session;
+        session.getProgram().setLimits(steps, time);
+        session.run(input, output);
+        return output.str();
+      });
+  std::future<std::string> result = task->get_future();
+  post([task]() { (*task)(); });
+  return result;
+}
+
+std::future<std::string> Server::submit(std::shared_ptr<const Session::Snapshot> base, std::string input) {
+  auto task = std::make_shared<std::packaged_task<std::string()>>(
+      [base = std::move(base), input = std::move(input), steps = stepLimit, time = timeLimit]() {
+        StringReader reader(input);
+        std::ostringstream output;
+        Session session(*base);
+        session.getProgram().setLimits(steps, time);
+        session.runProgram(reader, output);
+        return output.str();
+      });
+  std::future<std::string> result = task->get_future();
+  post([task]() { (*task)(); });
+  return result;
+}
+
+/*
+ * Implementation notes: serve
+ * ---------------------------
+ * One thread polls the listening socket and every connection.  Whatever
+ * arrives is fed to the connection's LineQueue, and the session is
+ * resumed on the pool unless a resume is already scheduled; a session
+ * waiting for input therefore holds no thread at all.  The resume job
+ * checks for more input under the connection's lock before it gives up
+ * the schedule, so no input is left unnoticed.  Output the socket could
+ * not take at once is sent by the polling thread whenever the socket is
+ * writable.  Finished connections and newly held-up output are reported
+ * through a pipe, and a finished connection is dropped by the polling
+ * thread once all of its output has gone out.  The pipe lives as long as
+ * the server, as jobs may still write to it after serve has failed.
+ */
+
+struct Server::Connection {
+  Connection(int fd, int wakeFd) : socket(fd), buffer(fd, wakeFd), output(&buffer) {
+    session.start(input, output);
+  }
+
+  Socket socket; //closed last, after the output is flushed
+  SocketBuffer buffer;
+  std::ostream output;
+  LineQueue input;
+  Session session;
+  std::mutex lock;
+  bool scheduled = false; //guarded by lock
+  bool inputClosed = false; //only used by the polling thread
+  std::atomic<bool> finished{false};
+};
+
+void Server::serve(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) error("SOCKET PATH TOO LONG");
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  Socket listener(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (listener.fd < 0) socketError();
+  unlink(path.c_str());
+  if (bind(listener.fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener.fd, SOMAXCONN) < 0) {
+    socketError();
+  }
+  if (wakeFds[0] < 0) {
+    if (pipe(wakeFds) < 0) socketError();
+    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+  }
+
+  std::unordered_map<int, std::shared_ptr<Connection>> connections; //by file descriptor
+  std::vector<pollfd> polls;
+  char chunk[1 << 12];
+  while (true) {
+    polls.clear();
+    polls.push_back({listener.fd, POLLIN, 0});
+    polls.push_back({wakeFds[0], POLLIN, 0});
+    for (auto it = connections.begin(); it != connections.end();) {
+      Connection &connection = *it->second;
+      bool finished = connection.finished; //before looking at its output, which is all written by then
+      bool unsent = connection.buffer.hasUnsent();
+      if (finished && !unsent) {
+        it = connections.erase(it);
+        continue;
+      }
+      short events = (connection.inputClosed || finished ? 0 : POLLIN) | (unsent ? POLLOUT : 0);
+      if (events != 0) polls.push_back({it->first, events, 0});
+      ++it;
+    }
+    if (poll(polls.data(), polls.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      socketError();
+    }
+    if (polls[1].revents != 0) {
+      while (read(wakeFds[0], chunk, sizeof(chunk)) > 0) {
+      }
+    }
+    for (size_t i = 2; i < polls.size(); i++) {
+      if (polls[i].revents == 0) continue;
+      std::shared_ptr<Connection> &connection = connections.at(polls[i].fd);
+      if (polls[i].events & POLLOUT) connection->buffer.sendUnsent();
+      if (!(polls[i].events & POLLIN)) continue;
+      ssize_t count = read(polls[i].fd, chunk, sizeof(chunk));
+      if (count > 0) {
+        connection->input.feed(std::string_view(chunk, count));
+      } else if (count == 0 || (errno != EINTR && errno != EAGAIN)) {
+        connection->input.close();
+        connection->inputClosed = true;
+      }
+      schedule(connection);
+    }
+    if (polls[0].revents != 0) {
+      int fd = accept(listener.fd, nullptr, nullptr);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        auto connection = std::make_shared<Connection>(fd, wakeFds[1]);
+        connection->session.getProgram().setLimits(stepLimit, timeLimit);
+        connections.emplace(fd, std::move(connection));
+      } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+        socketError();
+      }
+    }
+  }
+}
+
+void Server::schedule(const std::shared_ptr<Connection> &connection) {
+  {
+    std::lock_guard<std::mutex> guard(connection->lock);
+    if (connection->scheduled) return;
+    connection->scheduled = true;
+  }
+  post([connection, wakeFd = wakeFds[1]]() {
+    while (true) {
+      Session::Status status = Session::FINISHED;
+      try {
+        status = connection->session.resume();
+      } catch (std::exception &ex) {
+        //the session is lost, but the server and the other sessions go on
+      }
+      std::lock_guard<std::mutex> guard(connection->lock);
+      if (status == Session::FINISHED) {
+        connection->finished = true;
+        connection->scheduled = false;
+        char wake = 0;
+        (void) !write(wakeFd, &wake, 1);
+        return;
+      }
+      if (!connection->input.hasLine()) {
+        connection->scheduled = false;
+        return;
+      }
+    }
+  });
+}
+
+/*
+ * Implementation notes: post, take, work
+ * --------------------------------------
+ * Posting and taking a job only lock the one queue they touch.  sleepLock
+ * is for workers that found every queue empty: such a worker counts
+ * itself in idle under the lock and looks once more before it waits, and
+ * post only takes the lock to wake one if idle says someone may be
+ * asleep.  The fences order each side's write before its read of the
+ * other's, so either the worker sees the new job or post sees the
+ * worker; and as post takes sleepLock before notifying, a worker that
+ * has counted itself is waiting by then or still about to look.
+ */
+
+void Server::post(std::function<void()> job) {
+  Worker &worker = *workers[nextQueue++ % workers.size()];
+  {
+    std::lock_guard<std::mutex> guard(worker.lock);
+    worker.jobs.push_back(std::move(job));
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (idle.load(std::memory_order_relaxed) == 0) return;
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+  }
+  wake.notify_one();
+}
+
+bool Server::take(size_t index, std::function<void()> &job) {
+  for (size_t i = 0; i < workers.size(); i++) {
+    Worker &worker = *workers[(index + i) % workers.size()];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    if (worker.jobs.empty()) continue;
+    if (i == 0) {
+      job = std::move(worker.jobs.front()); //oldest of its own
+      worker.jobs.pop_front();
+    } else {
+      job = std::move(worker.jobs.back()); //newest of another worker's
+      worker.jobs.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void Server::work(size_t index) {
+  std::function<void()> job;
+  while (true) {
+    if (!take(index, job)) {
+      std::unique_lock<std::mutex> guard(sleepLock);
+      idle.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!take(index, job)) {
+        if (stopping) { //and nothing is left to do
+          idle.fetch_sub(1, std::memory_order_relaxed);
+          return;
+        }
+        wake.wait(guard);
+      }
+      idle.fetch_sub(1, std::memory_order_relaxed);
+    }
+    job();
+    job = nullptr;
+  }
+}
@@ -0,0 +1,141 @@
+/*
+ * File: server.h
+ * --------------
+ * This interface exports the Server class, which runs many independent
+ * BASIC sessions at once on a pool of worker threads, fed either from
+ * scripts in memory or from connections to a Unix-domain socket.
+ */
+
+#ifndef _server_h
+#define _server_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "program.hpp"
+#include "session.hpp"
+
+/*
+ * Class: Server
+ * -------------
+ * Every job runs one Session, or one turn of it, on a worker thread.
+ * Each worker has its own queue: jobs are dealt out to the queues in
+ * turn, a worker takes the oldest job from its own queue, and a worker
+ * whose queue is empty steals the newest job from another one, so a few
+ * long sessions do not hold up the short ones queued behind them.
+ */
+
+class Server {
+
+public:
+
+/*
+ * Constructor: Server
+ * Usage: Server server(threads);
+ * ------------------------------
+ * Starts threads worker threads, at least one.
+ */
+
+  explicit Server(unsigned threads);
+
+/*
+ * Destructor: ~Server
+ * Usage: usually implicit
+ * -----------------------
+ * Waits until every submitted job has finished and stops the workers.
+ */
+
+  ~Server();
+
+  Server(const Server &) = delete;
+
+  Server &operator=(const Server &) = delete;
+
+/*
+ * Method: setLimits
+ * Usage: server.setLimits(steps, time);
+ * -------------------------------------
+ * Sets the limits every RUN of the sessions started from now on is
+ * subject to, as Program::setLimits does for a single program.
+ */
+
+  void setLimits(long long steps, std::chrono::milliseconds time);
+
+/*
+ * Method: submit
+ * Usage: std::future<std::string> output = server.submit(script);
+ * ---------------------------------------------------------------
+ * Runs script, one line per command, in a fresh session and returns
+ * everything it printed once it has finished.
+ */
+
+  std::future<std::string> submit(std::string script);
+
+/*
+ * Method: submit
+ * Usage: std::future<std::string> output = server.submit(base, input);
+ * --------------------------------------------------------------------
+ * Runs the program of base once in a session restored from it, reading
+ * its INPUT lines from input, and returns everything it printed.  The
+ * sessions only share the statements of base, so any number of these
+ * jobs may run the same program at once.
+ */
+
+  std::future<std::string> submit(std::shared_ptr<const Session::Snapshot> base, std::string input);
+
+/*
+ * Method: serve
+ * Usage: server.serve(path);
+ * --------------------------
+ * Listens on a Unix-domain socket at path, replacing any file there, and
+ * runs a fresh session for every connection with the connection as its
+ * input and output.  The connection is closed when the session ends
+ * and its output has been sent.  The calling thread waits for all
+ * connections at once, and a session only occupies a worker while it
+ * has input to process, so sessions waiting in INPUT, or for a client
+ * to read what they printed, cost no thread.  Only returns if the socket cannot
+ * be created or fails, in which case it raises an error.
+ */
+
+  void serve(const std::string &path);
+
+private:
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::mutex sleepLock;
+  std::condition_variable wake;
+  std::atomic<size_t> idle{0}; //workers that found no job and may be waiting
+  bool stopping = false; //guarded by sleepLock
+  std::atomic<size_t> nextQueue{0};
+  long long stepLimit = BASIC_STEP_LIMIT;
+  std::chrono::milliseconds timeLimit{BASIC_TIME_LIMIT_MS};
+
+  void post(std::function<void()> job);
+
+  bool take(size_t index, std::function<void()> &job);
+
+  void work(size_t index);
+
+  struct Connection;
+
+  int wakeFds[2] = {-1, -1}; //pipe through which jobs tell serve that a connection has finished
+
+  void schedule(const std::shared_ptr<Connection> &connection);
+
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * File: session.cpp
+ * -----------------
+ * This file implements the session.h interface.
+ */
+
+#include <string>
+#include "session.hpp"
+#include "Utils/error.hpp"
+
+Session::Session(const Snapshot &snapshot)
+    : program(snapshot.program), state(snapshot.state), current(snapshot.current),
+      next(snapshot.next), finished(snapshot.finished) {
+}
+
+void Session::run(LineSource &input, std::ostream &output) {
+  start(input, output);
+  resume();
+}
+
+void Session::start(LineSource &input, std::ostream &output) {
+  this->input = &input;
+  this->output = &output;
+  state.setInput(&input);
+  state.setOutput(&output);
+}
+
+/*
+ * Implementation notes: resume
+ * ----------------------------
+ * A line is only dropped once it has been processed completely, so a
+ * line that waits for input is picked up again by the next call, and
+ * ParsedLine::apply resumes the statement, or the program, that waited.
+ */
+
+Session::Status Session::resume() {
+  if (finished) return FINISHED;
+  try {
+    while (true) {
+      if (current) {
+        bool done = true;
+        try {
+          done = current->apply(program, state, next);
+        } catch (ErrorException &ex) {
+          *output << ex.getMessage() << '\n';
+        }
+        if (!done) {
+          output->flush();
+          return WAITING;
+        }
+        current.reset();
+      }
+      std::string_view line;
+      LineSource::Status status = input->tryReadLine(line);
+      if (status == LineSource::PENDING) {
+        output->flush();
+        return WAITING;
+      }
+      if (status == LineSource::END) break;
+      current.emplace(std::string(line));
+      next = 0;
+    }
+  } catch (QuitException &ex) {
+  }
+  output->flush();
+  finished = true;
+  return FINISHED;
+}
+
+void Session::runProgram(LineSource &input, std::ostream &output) {
+  start(input, output);
+  try {
+    program.run(state);
+  } catch (ErrorException &ex) {
+    output << ex.getMessage() << '\n';
+  } catch (QuitException &ex) { //only INPUT raises it while a program runs, when input has ended
+    output << "NO MORE INPUT\n";
+  }
+  output.flush();
+}
+
+Session::Snapshot Session::snapshot() const {
+  return {program, state, current, next, finished};
+}
+
+void Session::restore(const Snapshot &snapshot) {
+  program = snapshot.program;
+  state = snapshot.state;
+  state.setInput(input);
+  state.setOutput(output);
+  current = snapshot.current;
+  next = snapshot.next;
+  finished = snapshot.finished;
+}
+
+Program &Session::getProgram() {
+  return program;
+}
+
+EvalState &Session::getState() {
+  return state;
+}
@@ -0,0 +1,145 @@
+/*
+ * File: session.h
+ * ---------------
+ * This interface exports the Session class, one interpreter with its own
+ * program and variables.  Sessions share nothing but the statement table
+ * and the symbol table, so any number of them may run at once on
+ * different threads.
+ */
+
+#ifndef _session_h
+#define _session_h
+
+#include <optional>
+#include <ostream>
+#include "evalstate.hpp"
+#include "linereader.hpp"
+#include "program.hpp"
+#include "statement.hpp"
+
+class Session {
+
+public:
+
+  enum Status {
+    WAITING, FINISHED
+  };
+
+/*
+ * Method: run
+ * Usage: session.run(input, output);
+ * ----------------------------------
+ * Processes the lines of input the way the command loop does until the
+ * input ends or QUIT is entered.  Everything the session prints,
+ * including error messages, goes to output, and INPUT statements read
+ * from input as well.  This is start followed by resume, for inputs
+ * that block rather than return PENDING.
+ */
+
+  void run(LineSource &input, std::ostream &output);
+
+/*
+ * Methods: start, resume
+ * Usage: session.start(input, output);
+ *        if (session.resume() == Session::FINISHED) . . .
+ * -----------------------------------------------------
+ * The resumable form of run.  resume processes lines until input has
+ * none ready, which it reports as WAITING after flushing output, or
+ * until the session is over.  When input is waiting in the middle of
+ * a line or of a running program, the next resume carries on right
+ * there, so the thread that calls resume is never blocked by the
+ * session and one thread can take turns with any number of them.
+ */
+
+  void start(LineSource &input, std::ostream &output);
+
+  Status resume();
+
+/*
+ * Method: runProgram
+ * Usage: session.runProgram(input, output);
+ * -----------------------------------------
+ * Runs the program of the session once, as RUN does, with its INPUT
+ * statements reading from input and everything it prints going to
+ * output, followed by the message of any error that stops it.  An
+ * INPUT that finds input at its end prints NO MORE INPUT after its
+ * prompt and stops the program, so the output always ends with a
+ * complete line.  input has to block rather than return PENDING.
+ */
+
+  void runProgram(LineSource &input, std::ostream &output);
+
+/*
+ * Type: Snapshot
+ * --------------
+ * Everything a session is made of apart from its input and output: the
+ * program with its run state, the variables, and the line the session
+ * was processing.  The program's source lines, statements and linked
+ * code are shared with the session until either of them is edited, so
+ * a snapshot, and every session restored from it, only copies the
+ * variables and the state of the run.
+ */
+
+  struct Snapshot {
+    Program program;
+    EvalState state;
+    std::optional<ParsedLine> current;
+    size_t next = 0;
+    bool finished = false;
+  };
+
+/*
+ * Methods: snapshot, restore
+ * Usage: Session::Snapshot warm = session.snapshot();
+ *        clone.restore(warm);
+ * -------------------------------------------------
+ * snapshot copies the session between two calls of resume, including
+ * while a program is waiting in INPUT.  restore replaces the session by
+ * one that carries on exactly where the snapshot was taken, reading from
+ * and printing to the input and output of this session, so a warmed-up
+ * session can be cloned any number of times.
+ */
+
+  Snapshot snapshot() const;
+
+  void restore(const Snapshot &snapshot);
+
+/*
+ * Constructor: Session
+ * Usage: Session session;
+ *        Session clone(warm);
+ * ------------------------------
+ * Creates an empty session, or one that carries on from a snapshot the
+ * way restore does, without first building the empty program and
+ * variables restore would replace.  Either has to be started before it
+ * reads or prints anything.
+ */
+
+  Session() = default;
+
+  explicit Session(const Snapshot &snapshot);
+
+/*
+ * Methods: getProgram, getState
+ * Usage: session.getProgram().setLimits(steps, time);
+ * ---------------------------------------------------
+ * Return the program and the variables of the session.
+ */
+
+  Program &getProgram();
+
+  EvalState &getState();
+
+private:
+
+  Program program;
+  EvalState state;
+  LineSource *input = nullptr;
+  std::ostream *output = nullptr;
+  std::optional<ParsedLine> current; //the line being processed, if it had to wait
+  size_t next = 0; //statement of current to go on with
+  bool finished = false;
+
+};
+
+#endif
@@ -7,141 +7,536 @@
  * BASIC statements.
  */
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
 #include "statement.hpp"
+#include "image.hpp"
+#include "allocstats.hpp"
 
 
 /* Implementation of the Statement class */
 
 void Statement::execute(EvalState &state, Program &program) const {
-  StatementType::get(name).runFunc(args, state, program);
+  state.getCounters().statements[type->index]++;
+  switch (fusion) {
+    case INCREMENT:
+      if (!state.isDefined(var)) error("VARIABLE NOT DEFINED");
+      state.setValue(var, addValues(state.getValue(var), constant));
+      return;
+    case BRANCH: {
+      if (!state.isDefined(var)) error("VARIABLE NOT DEFINED");
+      Value lhs = state.getValue(var);
+      bool flag = cmp == '=' ? lhs == constant : cmp == '<' ? lhs < constant : lhs > constant;
+      if (flag) {
+        program.branch();
+      }
+      return;
+    }
+    case JUMP:
+      program.branch();
+      return;
+    case NEXT:
+      program.endLoop(var, state);
+      return;
+    case INLINED:
+      for (auto &def: inlinedDefs) {
+        if (!state.isDefinedAs(def.first, def.second)) { //not defined, or by another DEF
+          type->runFunc(*original, state, program);
+          return;
+        }
+      }
+      type->runFunc(*this, state, program);
+      return;
+    default:
+      type->runFunc(*this, state, program);
+  }
 }
 
-Statement::Statement(const std::string &name, const std::smatch &matches) {
-  this->name = name;
+Statement::Statement(const StatementType &type, const std::smatch &matches) {
+  this->type = &type;
   for (auto &arg: matches) {
     this->args.push_back(arg); //have to be copied as matches just point to the string which may be recycled
   }
+  for (int i: type.expArgs) {
+    if (args[i].empty()) {
+      this->exps.emplace_back(); //an optional clause that was left out
+    } else {
+      this->exps.push_back(i == type.condArg ? compileCondition(args[i]) : compileExp(args[i]));
+    }
+  }
+  for (int i: type.targetArgs) {
+    this->targets.push_back(compileExp(args[i]));
+    if (!targets.back().isVariable() && !targets.back().isElement()) syntaxError();
+  }
+  fuse();
+}
+
+Statement::Statement(const StatementType &type) {
+  this->type = &type;
+}
+
+const std::regex Statement::INCREMENT_REGEX = std::regex("^\\s*([A-Za-z][A-Za-z0-9]*)\\s*([\\+\\-])\\s*([0-9]{1,9})\\s*$");
+const std::regex Statement::BRANCH_REGEX = std::regex("^\\s*([A-Za-z][A-Za-z0-9]*)\\s*([<=>])\\s*([0-9]{1,9})\\s*$");
+const std::regex Statement::FUNCTION_REGEX = std::regex("^(FN[A-Za-z0-9]+)\\s*\\(\\s*([A-Za-z][A-Za-z0-9]*)\\s*\\)$");
+
+namespace {
+
+int lineTarget(const std::string &str) {
+  int line;
+  std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), line);
+  return result.ec == std::errc() ? line : -1; //a number this large cannot be a line
+}
+
+int listBound(const std::string &str) { //of a LIST range
+  int line;
+  std::from_chars_result result = std::from_chars(str.data(), str.data() + str.size(), line);
+  return result.ec == std::errc() ? line : INT_MAX; //beyond every line
+}
+
+}
+
+/*
+ * Implementation notes: fuse
+ * --------------------------
+ * Recognises the statements that dominate BASIC loops and pre-decodes
+ * them so execute never touches the regex or the expression parser.
+ * Anything that does not match exactly falls back to generic dispatch,
+ * so errors are still reported by the same code as before.  Branch
+ * targets, FOR control variables and DEF functions are decoded here as
+ * well, so the program can resolve them when it is linked.
+ */
+
+void Statement::fuse() {
+  const std::string &name = type->name;
+  std::smatch sm;
+  if (name == "LET") {
+    if (targets[0].isVariable() && std::regex_match(args[3], sm, INCREMENT_REGEX) && sm[1] == args[1]) {
+      var = targets[0].getSymbol();
+      constant = std::stoi(sm[3]);
+      if (sm[2] == "-") constant = -constant;
+      fusion = INCREMENT;
+    }
+  } else if (name == "IF") {
+    target = lineTarget(args[3]);
+    if (std::regex_match(args[1], sm, BRANCH_REGEX)) {
+      var = Symbols::intern(sm[1].str());
+      constant = std::stoi(sm[3]);
+      cmp = sm[2].str()[0];
+      fusion = BRANCH;
+    }
+  } else if (name == "GOTO") {
+    target = lineTarget(args[1]);
+    fusion = JUMP;
+  } else if (name == "GOSUB") {
+    target = lineTarget(args[1]);
+  } else if (name == "ON") {
+    std::stringstream list(args[3]);
+    std::string line;
+    while (std::getline(list, line, ',')) {
+      lines.push_back(lineTarget(trim(line)));
+    }
+  } else if (name == "FOR") {
+    var = Symbols::intern(args[1]);
+  } else if (name == "NEXT") {
+    var = Symbols::intern(args[1]);
+    fusion = NEXT;
+  } else if (name == "DEF") {
+    std::regex_match(args[1], sm, FUNCTION_REGEX);
+    if (!StatementType::varPredicate(sm[2])) syntaxError();
+    var = Symbols::intern(sm[1].str());
+    param = Symbols::intern(sm[2].str());
+    function = std::make_shared<const CompiledExp>(exps[0]);
+  }
+}
+
+namespace {
+
+/*
+ * The keywords of all statement types, in the order they are added.
+ * keywordHash sends each of them to a different slot of SLOTS, with a
+ * seed that is searched for at compile time, so recognising a keyword
+ * costs one hash and one comparison and the table can never change.
+ */
+
+constexpr std::string_view KEYWORDS[] = {
+  "REM", "LET", "PRINT", "INPUT", "DIM", "END", "GOTO", "IF", "ON", "GOSUB", "RETURN", "FOR", "NEXT", "DEF",
+  "RUN", "LIST", "CLEAR", "QUIT", "HELP", "SAVE", "LOAD", "TRACE", "STATS"
+};
+
+constexpr size_t KEYWORD_COUNT = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+constexpr uint32_t SLOT_COUNT = 64; //a power of two, comfortably more than KEYWORD_COUNT
+
+constexpr uint32_t keywordHash(std::string_view word, uint32_t seed) {
+  uint32_t hash = seed;
+  for (char c: word) {
+    hash = (hash ^ uint8_t(c)) * 16777619u;
+  }
+  return (hash ^ (hash >> 16)) & (SLOT_COUNT - 1);
+}
+
+constexpr bool isPerfect(uint32_t seed) {
+  bool used[SLOT_COUNT] = {};
+  for (std::string_view word: KEYWORDS) {
+    uint32_t slot = keywordHash(word, seed);
+    if (used[slot]) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t findSeed() {
+  uint32_t seed = 2166136261u;
+  while (!isPerfect(seed)) seed++;
+  return seed;
+}
+
+constexpr uint32_t SEED = findSeed();
+
+constexpr std::array<int8_t, SLOT_COUNT> buildSlots() {
+  std::array<int8_t, SLOT_COUNT> slots{};
+  for (auto &slot: slots) {
+    slot = -1;
+  }
+  for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+    slots[keywordHash(KEYWORDS[i], SEED)] = int8_t(i);
+  }
+  return slots;
+}
+
+constexpr std::array<int8_t, SLOT_COUNT> SLOTS = buildSlots();
+
+constexpr int keywordIndex(std::string_view word) { //in KEYWORDS, -1 if word is none
+  int index = SLOTS[keywordHash(word, SEED)];
+  return index >= 0 && KEYWORDS[index] == word ? index : -1;
+}
+
+static_assert(keywordIndex("REM") == 0 && keywordIndex("STATS") == int(KEYWORD_COUNT) - 1, "keyword table");
+static_assert(KEYWORD_COUNT <= Counters::MAX_STATEMENT_TYPES, "too many keywords to count");
+static_assert(keywordIndex("X") < 0 && keywordIndex("PRINTX") < 0, "keyword table");
+
+/*
+ * Only the keywords the interpreter started out with are reserved, so
+ * programs that already use later ones such as NEXT, DEF or SAVE as
+ * variable names keep working.  Statements are told apart by their
+ * first word, so none of the later keywords is ambiguous as a name.
+ */
+
+constexpr std::string_view RESERVED[] = {
+  "REM", "LET", "PRINT", "INPUT", "END", "GOTO", "IF", "RUN", "LIST", "CLEAR", "QUIT", "HELP"
+};
+
 }
 
-std::unordered_map<std::string, StatementType> StatementType::statementMap;
 const std::string StatementType::VAR = "([A-Za-z0-9]+)"; //captured
-const std::string StatementType::EXP = "([\\+\\-\\*\\/ ()A-Za-z0-9]+)"; //captured
+const std::string StatementType::TARGET = "([A-Za-z0-9]+(?:\\s*\\([\\+\\-\\*\\/ ()A-Za-z0-9]+\\))?)"; //captured, variable or element
+const std::string StatementType::ELEMENT = "([A-Za-z0-9]+\\s*\\([\\+\\-\\*\\/ ()A-Za-z0-9]+\\))"; //captured
+const std::string StatementType::EXP = "([\\+\\-\\*\\/ ()A-Za-z0-9]+?)"; //captured, lazy so it leaves optional clauses alone
 const std::string StatementType::LINE = "([0-9]+)"; //captured
-const std::string StatementType::CMP = "([<=>])"; //captured
+const std::string StatementType::COND = "([\\+\\-\\*\\/ ()A-Za-z0-9<=>]+?)"; //captured, lazy
 const std::string StatementType::EQUAL = "(=)"; //captured
 const std::string StatementType::THEN = "(THEN)"; //captured
+const std::string StatementType::TO = "(TO)"; //captured
+const std::string StatementType::GOTO = "(GOTO)"; //captured
+const std::string StatementType::LINES = "([0-9]+(?:\\s*,\\s*[0-9]+)*)"; //captured, separated by commas
+const std::string StatementType::STEP = "(?:\\s+STEP\\s+([\\+\\-\\*\\/ ()A-Za-z0-9]+?))?"; //optional, captured if present
 const std::string StatementType::ANY = "(.+)"; //captured
+const std::string StatementType::RANGE = "([0-9]+(?:\\s*-\\s*[0-9]+)?)?"; //optional line or range, captured if present
+const std::string StatementType::FUNCTION = "(FN[A-Za-z0-9]+\\s*\\(\\s*[A-Za-z][A-Za-z0-9]*\\s*\\))"; //captured, name and parameter
 
 const std::string StatementType::SEPARATOR = "\\s+";
 const std::string StatementType::EMPTY = "\\s*";
-const std::regex StatementType::NUM_REGEX = std::regex("^-?[0-9]+$");
 
 StatementType::StatementType(const std::string &name, const std::vector<std::string> &patterns,
                              const std::function<decltype(run)> &runFunc, int lineFlag) {
   this->lineFlag = lineFlag;
   this->name = name;
+  this->takesRest = !patterns.empty() && patterns.back() == ANY;
   std::string patternStr = "^";
 
   patternStr += EMPTY;
   for (int i = 0; i < patterns.size(); i++) {
+    if (i > 0 && patterns[i] != STEP) { //optional clauses bring their own separator
+      patternStr += SEPARATOR;
+    }
     patternStr += patterns[i];
-    patternStr += (i == patterns.size() - 1) ? EMPTY : SEPARATOR;
-    this->predicates.emplace_back(patterns[i] == VAR ? varPredicate : passPredicate);
+    bool target = patterns[i] == TARGET || patterns[i] == ELEMENT;
+    this->predicates.emplace_back(patterns[i] == VAR ? varPredicate : target ? targetPredicate : passPredicate);
+    if (patterns[i] == COND) {
+      this->condArg = i + 1;
+    }
+    if (patterns[i] == EXP || patterns[i] == STEP || patterns[i] == COND) {
+      this->expArgs.push_back(i + 1); //i+1 because 0 is the whole string
+    } else if (target) {
+      this->targetArgs.push_back(i + 1);
+    }
   }
 
+  patternStr += EMPTY;
   patternStr += "$";
   this->pattern = std::regex(patternStr);
   this->runFunc = runFunc;
 }
 
-void StatementType::eval(int lineNumber, const std::string &info, EvalState &state, Program &program) const {
+void StatementType::split(std::string_view line, int &lineNumber, std::string &command, std::string &info) {
+  static const std::regex inputPattern("^([0-9]+\\s*)?([A-Z]+)?(.*)$");
+  std::cmatch matches;
+  std::regex_match(line.data(), line.data() + line.size(), matches, inputPattern);
+  lineNumber = matches[1].matched ? std::stoi(matches[1].str()) : -1;
+  command = matches[2];
+  info = matches[3]; //may begin with space
+}
+
+Statement StatementType::parse(int lineNumber, const std::string &info) const {
   if ((lineFlag == -1 && lineNumber >= 0) || (lineFlag == 1 && lineNumber < 0)) {
     syntaxError();
   }
   std::smatch matches;
-  if (std::regex_match(info, matches, pattern)) {
-    for (int i = 0; i < predicates.size(); i++) {
-      if (!predicates[i](matches[i + 1])) { //i+1 because 0 is the whole string
-        syntaxError();
-      }
+  if (!std::regex_match(info, matches, pattern)) {
+    syntaxError();
+  }
+  for (int i = 0; i < predicates.size(); i++) {
+    if (!predicates[i](matches[i + 1])) { //i+1 because 0 is the whole string
+      syntaxError();
     }
-    Statement statement(name, matches);
-    if (lineNumber < 0) {
+  }
+  return Statement(*this, matches);
+}
+
+std::vector<Statement> StatementType::parseLine(int lineNumber, const std::string &info) const {
+  std::vector<Statement> statements;
+  const StatementType *type = this;
+  std::string rest = info;
+  while (true) {
+    size_t colon = type->takesRest ? std::string::npos : rest.find(':');
+    statements.push_back(type->parse(lineNumber, rest.substr(0, colon)));
+    if (colon == std::string::npos) break;
+    int number;
+    std::string command;
+    split(trim(rest.substr(colon + 1)), number, command, rest);
+    if (number >= 0 || command.empty()) syntaxError();
+    type = &get(command);
+  }
+  return statements;
+}
+
+void StatementType::eval(int lineNumber, const std::string &info, EvalState &state, Program &program) const {
+  std::vector<Statement> statements = parseLine(lineNumber, info);
+  if (lineNumber < 0) {
+    for (auto &statement: statements) {
       statement.execute(state, program);
-    } else {
-      program.setParsedStatement(lineNumber, statement);
     }
   } else {
-    syntaxError();
+    program.setParsedStatements(lineNumber, statements);
   }
 }
 
 const StatementType &StatementType::get(const std::string &name) {
-  {
-    auto it = statementMap.find(name);
-    if (it == statementMap.end()) {
-      syntaxError();
-    }
-    return it->second;
+  const StatementType *type = find(name);
+  if (type == nullptr) {
+    syntaxError();
   }
+  return *type;
+}
+
+const StatementType *StatementType::find(std::string_view name) {
+  int index = keywordIndex(name);
+  return index < 0 ? nullptr : &table()[index];
+}
+
+const std::vector<StatementType> &StatementType::table() {
+  static const std::vector<StatementType> types = registerAll(); //built once, even with several threads
+  return types;
+}
+
+std::string_view StatementType::keyword(int index) {
+  return index >= 0 && index < int(KEYWORD_COUNT) ? KEYWORDS[index] : "";
 }
 
 void StatementType::init() {
-  add("REM", {ANY}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {}, 1);
-  add("LET", {VAR, EQUAL, EXP}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    state.setValue(data[1], parseExp(data[3], state));
+  table();
+}
+
+std::vector<StatementType> StatementType::registerAll() {
+  AllocationStats::Scope scope(AllocationStats::PARSER); //the patterns are compiled here
+  std::vector<StatementType> types;
+  add(types, "REM", {ANY}, [](const Statement &stmt, EvalState &state, Program &program) {}, 1);
+  add(types, "LET", {TARGET, EQUAL, EXP}, [](const Statement &stmt, EvalState &state, Program &program) {
+    stmt.targets[0].store(state, stmt.exps[0].eval(state));
+  }, 0);
+  add(types, "PRINT", {EXP}, [](const Statement &stmt, EvalState &state, Program &program) {
+    state.getOutput() << stmt.exps[0].eval(state) << '\n';
   }, 0);
-  add("PRINT", {EXP}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    std::cout << parseExp(data[1], state) << std::endl;
+  add(types, "INPUT", {TARGET}, [](const Statement &stmt, EvalState &state, Program &program) {
+    LineSource &input = state.getInput();
+    std::ostream &output = state.getOutput();
+    std::string_view val;
+    Value value;
+    if (!state.isWaiting()) output << " ? "; //a retried INPUT has shown its prompt already
+    while (true) {
+      LineSource::Status status = input.tryReadLine(val);
+      if (status == LineSource::PENDING) { //try again once the line has arrived
+        state.setWaiting(true);
+        program.suspend();
+        return;
+      }
+      if (status == LineSource::END) throw QuitException(); //nothing left to read, finish as if QUIT had been entered
+      if (stringToValue(val, value)) break; //also rejects numbers that do not fit into a Value
+      output << "INVALID NUMBER\n";
+      output << " ? ";
+    }
+    state.setWaiting(false);
+    stmt.targets[0].store(state, value);
   }, 0);
-  add("INPUT", {VAR}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    std::cout << " ? ";
-    std::string val;
-    std::smatch sm;
-    getline(std::cin, val);
-    while (!std::regex_match(val, sm, NUM_REGEX)) {
-      std::cout << "INVALID NUMBER" << std::endl;
-      std::cout << " ? ";
-      getline(std::cin, val);
-    }
-    state.setValue(data[1], std::stoi(sm[0]));
+  add(types, "DIM", {ELEMENT}, [](const Statement &stmt, EvalState &state, Program &program) {
+    state.dimension(stmt.targets[0].getSymbol(), stmt.targets[0].evalIndex(state));
   }, 0);
-  add("END", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
+  add(types, "END", {}, [](const Statement &stmt, EvalState &state, Program &program) {
     program.setCurrentLine(-1);
   }, 1);
-  add("GOTO", {LINE}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    program.setCurrentLine(std::stoi(data[1]));
+  add(types, "GOTO", {LINE}, [](const Statement &stmt, EvalState &state, Program &program) {
+    program.branch();
   }, 1);
-  add("IF", {EXP, CMP, EXP, THEN, LINE}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    int lhs = parseExp(data[1], state);
-    int rhs = parseExp(data[3], state);
-    char c = data[2][0];
-    bool flag = c == '=' ? lhs == rhs : c == '<' ? lhs < rhs : lhs > rhs;
-    if (flag) {
-      program.setCurrentLine(std::stoi(data[5]));
+  add(types, "IF", {COND, THEN, LINE}, [](const Statement &stmt, EvalState &state, Program &program) {
+    if (stmt.exps[0].eval(state) != 0) {
+      program.branch();
     }
   }, 1);
-  add("RUN", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
+  add(types, "ON", {EXP, GOTO, LINES}, [](const Statement &stmt, EvalState &state, Program &program) {
+    program.branchOn(stmt.exps[0].eval(state));
+  }, 1);
+  add(types, "GOSUB", {LINE}, [](const Statement &stmt, EvalState &state, Program &program) {
+    program.gosub();
+  }, 1);
+  add(types, "RETURN", {}, [](const Statement &stmt, EvalState &state, Program &program) {
+    program.returnFromGosub();
+  }, 1);
+  add(types, "FOR", {VAR, EQUAL, EXP, TO, EXP, STEP}, [](const Statement &stmt, EvalState &state, Program &program) {
+    Value start = stmt.exps[0].eval(state);
+    Value limit = stmt.exps[1].eval(state);
+    Value step = stmt.exps[2].isEmpty() ? 1 : stmt.exps[2].eval(state);
+    state.setValue(stmt.var, start);
+    program.beginLoop(stmt.var, limit, step, state);
+  }, 1);
+  add(types, "NEXT", {VAR}, [](const Statement &stmt, EvalState &state, Program &program) {
+    program.endLoop(stmt.var, state);
+  }, 1);
+  add(types, "DEF", {FUNCTION, EQUAL, EXP}, [](const Statement &stmt, EvalState &state, Program &program) {
+    state.defineFunction(stmt.var, stmt.param, stmt.function);
+  }, 0);
+  add(types, "RUN", {}, [](const Statement &stmt, EvalState &state, Program &program) {
     program.run(state);
   }, -1);
-  add("LIST", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    program.print();
+  add(types, "LIST", {RANGE}, [](const Statement &stmt, EvalState &state, Program &program) {
+    if (stmt.args[1].empty()) {
+      program.print(state.getOutput());
+      return;
+    }
+    size_t dash = stmt.args[1].find('-');
+    if (dash == std::string::npos) {
+      int line = listBound(trim(stmt.args[1]));
+      program.print(state.getOutput(), line, line);
+      return;
+    }
+    program.print(state.getOutput(), listBound(trim(stmt.args[1].substr(0, dash))),
+                  listBound(trim(stmt.args[1].substr(dash + 1))));
   }, -1);
-  add("CLEAR", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
+  add(types, "CLEAR", {}, [](const Statement &stmt, EvalState &state, Program &program) {
     program.clear();
     state.Clear();
   }, -1);
-  add("QUIT", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    exit(0);
+  add(types, "QUIT", {}, [](const Statement &stmt, EvalState &state, Program &program) {
+    throw QuitException();
+  }, -1);
+  add(types, "HELP", {}, [](const Statement &stmt, EvalState &state, Program &program) {
+    state.getOutput() << "Yet another basic interpreter\n";
+  }, -1);
+  add(types, "SAVE", {ANY}, [](const Statement &stmt, EvalState &state, Program &program) {
+    ProgramImage::save(program, trim(stmt.args[1]));
+  }, -1);
+  add(types, "LOAD", {ANY}, [](const Statement &stmt, EvalState &state, Program &program) {
+    std::vector<std::string> source;
+    if (ProgramImage::load(program, trim(stmt.args[1]), source)) {
+      state.getCounters().imageLoads++;
+    } else {
+      state.getCounters().imageReparses++;
+      loadSource(source, program);
+    }
+  }, -1);
+  add(types, "TRACE", {ANY}, [](const Statement &stmt, EvalState &state, Program &program) {
+    std::string command, filename;
+    std::istringstream args(stmt.args[1]);
+    args >> command;
+    std::getline(args, filename);
+    filename = trim(filename);
+    Trace &trace = program.getTrace();
+    if (command == "ON" && filename.empty()) {
+      trace.start();
+    } else if (command == "OFF" && filename.empty()) {
+      trace.stop();
+    } else if (command == "SAVE" && !filename.empty()) {
+      trace.save(filename);
+    } else if (command == "JSON" && !filename.empty()) {
+      trace.saveJson(filename);
+    } else {
+      syntaxError();
+    }
   }, -1);
-  add("HELP", {}, [](const std::vector<std::string> &data, EvalState &state, Program &program) {
-    std::cout << "Yet another basic interpreter" << std::endl;
+  add(types, "STATS", {}, [](const Statement &stmt, EvalState &state, Program &program) {
+    state.getCounters().report(state.getOutput());
+    AllocationStats::report(state.getOutput());
   }, -1);
+  if (types.size() != KEYWORD_COUNT) throw std::logic_error("a keyword has no statement type");
+  return types;
+}
+
+/*
+ * Implementation notes: loadSource
+ * --------------------------------
+ * Parses the lines of a program the way processLine would, but into
+ * temporaries, so a line that fails to parse leaves program unchanged.
+ */
+
+void StatementType::loadSource(const std::vector<std::string> &source, Program &program) {
+  AllocationStats::Scope scope(AllocationStats::PARSER);
+  std::map<int, std::string> lines;
+  std::map<int, std::vector<Statement>> statements;
+  for (auto &line: source) {
+    if (trim(line).empty()) continue;
+    int lineNumber;
+    std::string command, info;
+    split(line, lineNumber, command, info);
+    if (lineNumber < 0) {
+      syntaxError();
+    }
+    lines.erase(lineNumber);
+    statements.erase(lineNumber);
+    if (command.empty()) {
+      if (!info.empty()) syntaxError();
+      continue;
+    }
+    statements.emplace(lineNumber, get(command).parseLine(lineNumber, info));
+    lines.emplace(lineNumber, line);
+  }
+  program.clear();
+  for (auto &line: lines) {
+    program.addSourceLine(line.first, line.second);
+  }
+  for (auto &stmt: statements) {
+    program.setParsedStatements(stmt.first, stmt.second);
+  }
 }
 
-void StatementType::add(const std::string &name, const std::vector<std::string> &patterns,
-                        const std::function<decltype(run)> &runFunc, int lineFlag) {
-  statementMap.insert({name, StatementType(name, patterns, runFunc, lineFlag)});
+void StatementType::add(std::vector<StatementType> &types, const std::string &name,
+                        const std::vector<std::string> &patterns, const std::function<decltype(run)> &runFunc,
+                        int lineFlag) {
+  if (keywordIndex(name) != int(types.size())) throw std::logic_error(name + " is out of keyword order");
+  types.push_back(StatementType(name, patterns, runFunc, lineFlag));
+  types.back().index = int(types.size()) - 1;
 }
 
 bool StatementType::passPredicate(const std::string &str) {
@@ -149,8 +544,69 @@ bool StatementType::passPredicate(const std::string &str) {
 }
 
 bool StatementType::varPredicate(const std::string &str) {
-  return statementMap.find(str) == statementMap.end();
+  return std::find(std::begin(RESERVED), std::end(RESERVED), str) == std::end(RESERVED);
+}
+
+bool StatementType::targetPredicate(const std::string &str) {
+  return varPredicate(str.substr(0, str.find_first_of(" \t(")));
+}
+
+void StatementType::run(const Statement &stmt, EvalState &state, Program &program) {
+}
+
+ParsedLine::ParsedLine(std::string line) : line(std::move(line)) {
+  AllocationStats::Scope scope(AllocationStats::PARSER);
+  try {
+    std::string command, info;
+    StatementType::split(this->line, lineNumber, command, info);
+    if (command.empty()) {
+      if (lineNumber >= 0 && info.empty()) {
+        kind = REMOVE;
+      } else {
+        syntaxError();
+      }
+    } else {
+      statements = StatementType::get(command).parseLine(lineNumber, info);
+      kind = lineNumber < 0 ? EXECUTE : STORE;
+    }
+  } catch (ErrorException &ex) {
+    kind = FAIL;
+    message = ex.getMessage();
+  }
+}
+
+void ParsedLine::apply(Program &program, EvalState &state) const {
+  size_t next = 0;
+  apply(program, state, next);
+}
+
+bool ParsedLine::apply(Program &program, EvalState &state, size_t &next) const {
+  AllocationStats::Scope scope(AllocationStats::EVALUATOR);
+  switch (kind) {
+    case FAIL:
+      error(message);
+      break;
+    case REMOVE:
+      program.remove(lineNumber);
+      break;
+    case STORE:
+      program.setParsedStatements(lineNumber, statements);
+      program.addSourceLine(lineNumber, line);
+      break;
+    case EXECUTE:
+      for (; next < statements.size(); next++) {
+        if (program.isSuspended()) {
+          program.resume(state); //the RUN at next waited for input
+        } else {
+          statements[next].execute(state, program);
+        }
+        if (state.isWaiting()) return false;
+      }
+      break;
+  }
+  return true;
 }
 
-void StatementType::run(const std::vector<std::string> &data, EvalState &state, Program &program) {
+const std::string &ParsedLine::getLine() const {
+  return line;
 }
@@ -23,16 +23,57 @@
 #include "Utils/strlib.hpp"
 #include <regex>
 #include <functional>
+#include <optional>
+#include <string_view>
 
 class Program;
 
+class StatementType;
+
 class Statement {
   friend class StatementType;
-
-  std::string name;
+  friend class ProgramImage;
+  friend class Program;
+
+  /*
+   * Superinstructions recognised when a statement is compiled.  A fused
+   * statement runs straight from the pre-decoded fields below instead of
+   * dispatching through its StatementType and re-parsing its expressions.
+   */
+  enum Fusion {
+    NONE,      //generic dispatch through runFunc
+    INCREMENT, //LET V = V + c, LET V = V - c
+    BRANCH,    //IF V cmp c THEN n
+    JUMP,      //GOTO n
+    NEXT,      //NEXT V
+    INLINED    //a copy made by Program::link with DEF bodies inlined
+  };
+
+  const StatementType *type;
   std::vector<std::string> args;
+  std::vector<CompiledExp> exps; //one per EXP capture, in order
+  std::vector<CompiledExp> targets; //one per TARGET or ELEMENT capture, in order
+
+  Fusion fusion = NONE;
+  int var = -1; //symbol id of the INCREMENT target, BRANCH lhs, FOR/NEXT control variable or DEF function
+  int param = -1; //symbol id of the DEF parameter
+  Value constant = 0; //INCREMENT delta or BRANCH rhs
+  char cmp = 0; //BRANCH comparison
+  std::shared_ptr<const CompiledExp> function; //the body of a DEF, which every run of it defines the function as
+  const Statement *original = nullptr; //of an INLINED copy, run instead unless inlinedDefs are all current
+  std::vector<std::pair<int, const CompiledExp *>> inlinedDefs; //functions an INLINED copy assumes and their bodies
+  int target = -1; //line an IF, GOTO or GOSUB continues at, -1 if no line can have that number
+  std::vector<int> lines; //lines an ON ... GOTO chooses from, -1 where no line can have the number
+
+  static const std::regex INCREMENT_REGEX;
+  static const std::regex BRANCH_REGEX;
+  static const std::regex FUNCTION_REGEX;
+
+  Statement(const StatementType &type, const std::smatch &matches);
+
+  explicit Statement(const StatementType &type); //empty, filled in by ProgramImage
 
-  Statement(const std::string &name, const std::smatch &matches);
+  void fuse();
 
 public:
   void execute(EvalState &state, Program &program) const;
@@ -40,42 +81,148 @@ public:
 
 class StatementType {
   friend class Statement;
+  friend class ProgramImage;
+  friend class Program;
+  friend class Trace;
 
   std::string name;
+  int index; //of the keyword, which statements are counted by
   std::regex pattern;
   static bool passPredicate(const std::string &str);
   static bool varPredicate(const std::string &str);
+  static bool targetPredicate(const std::string &str);
   std::vector<std::function<decltype(passPredicate)>> predicates; //used to check LET
+  std::vector<int> expArgs; //indices of the EXP and COND captures, compiled once when a statement is parsed
+  int condArg = -1; //index of the COND capture, which is compiled as a condition
+  std::vector<int> targetArgs; //indices of the TARGET and ELEMENT captures, compiled like expArgs
   int lineFlag; //-1 for no line, 1 for line, 0 for both
-  static void run(const std::vector<std::string> &data, EvalState &state, Program &program); //just for decltype
+  bool takesRest; //ends with ANY, so a colon in its arguments does not end it
+  static void run(const Statement &stmt, EvalState &state, Program &program); //just for decltype
 
   std::function<decltype(run)> runFunc;
 
-  static std::unordered_map<std::string, StatementType> statementMap;
   static const std::string VAR;
+  static const std::string TARGET;
+  static const std::string ELEMENT;
   static const std::string EXP;
   static const std::string LINE;
-  static const std::string CMP;
+  static const std::string COND;
   static const std::string SEPARATOR;
   static const std::string EMPTY;
   static const std::string ANY;
   static const std::string EQUAL;
   static const std::string THEN;
+  static const std::string TO;
+  static const std::string GOTO;
+  static const std::string LINES;
+  static const std::string STEP;
+  static const std::string FUNCTION;
+  static const std::string RANGE;
 
-  static const std::regex NUM_REGEX;
-
-  static void add(const std::string &name, const std::vector<std::string> &patterns,
-                  const std::function<decltype(run)> &runFunc, int lineFlag);
+  static void add(std::vector<StatementType> &types, const std::string &name,
+                  const std::vector<std::string> &patterns, const std::function<decltype(run)> &runFunc,
+                  int lineFlag);
 
   StatementType(const std::string &name, const std::vector<std::string> &patterns,
                 const std::function<decltype(run)> &runFunc, int lineFlag);
 
+  static void loadSource(const std::vector<std::string> &source, Program &program);
+
+  static std::vector<StatementType> registerAll();
+
+  static const std::vector<StatementType> &table(); //indexed like the keywords
+
+  static const StatementType *find(std::string_view name); //null if name is no keyword
+
 public:
+  /*
+   * Builds the table of statement types ahead of their first use.  The
+   * keywords are fixed at compile time and the table is never changed
+   * once built, so any number of sessions may share it from different
+   * threads.
+   */
   static void init();
 
   static const StatementType &get(const std::string &name);
 
+  /*
+   * Returns the keyword with the given index, "" if there is none.
+   * Counters counts statements by this index.
+   */
+  static std::string_view keyword(int index);
+
+  /*
+   * Splits a line typed by the user into its optional line number (-1 if
+   * there is none), the command keyword and the rest of the line.
+   */
+  static void split(std::string_view line, int &lineNumber, std::string &command, std::string &info);
+
+  /*
+   * Checks info against this statement type and compiles it, raising a
+   * syntax error if it does not match or is not allowed with (or without)
+   * a line number.
+   */
+  Statement parse(int lineNumber, const std::string &info) const;
+
+  /*
+   * Like parse, but info may go on with further statements separated by
+   * colons, which are parsed as well.  The statements are returned in
+   * order, the one of this type first.
+   */
+  std::vector<Statement> parseLine(int lineNumber, const std::string &info) const;
+
   void eval(int lineNumber, const std::string &info, EvalState &state, Program &program) const;
 };
 
+/*
+ * Class: ParsedLine
+ * -----------------
+ * One line entered by the user, parsed but not yet applied.  Parsing
+ * depends neither on the program nor on the variables, so lines may be
+ * parsed ahead of the one being executed (see pipeline.h).  A line that
+ * fails to parse keeps its error, which apply reports.
+ */
+
+class ParsedLine {
+
+  enum Kind {
+    FAIL, REMOVE, STORE, EXECUTE
+  };
+
+  std::string line;
+  Kind kind = FAIL;
+  int lineNumber = -1;
+  std::vector<Statement> statements;
+  std::string message; //for FAIL
+
+public:
+  explicit ParsedLine(std::string line);
+
+  /*
+   * Does what the line asks for: stores or removes a program line, or
+   * executes an immediate command.  Errors are raised as exceptions.
+   */
+  void apply(Program &program, EvalState &state) const;
+
+  /*
+   * Like apply, but resumable: immediate statements are executed from
+   * statement next on.  If one of them has to wait for input, apply
+   * returns false with next at that statement, and calling it again
+   * once the input has arrived carries on where it stopped.
+   */
+  bool apply(Program &program, EvalState &state, size_t &next) const;
+
+  const std::string &getLine() const;
+};
+
+/*
+ * Class: QuitException
+ * --------------------
+ * Thrown by QUIT, and by INPUT when the input is exhausted, to unwind to
+ * the command loop, which then shuts the interpreter down.
+ */
+
+class QuitException : public std::exception {
+};
+
 #endif
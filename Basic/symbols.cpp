@@ -0,0 +1,87 @@
+/*
+ * File: symbols.cpp
+ * -----------------
+ * This file implements the symbols.h interface.
+ */
+
+#include <cstring>
+#include "symbols.hpp"
+#include "Utils/error.hpp"
+
+/*
+ * Implementation notes: intern
+ * ----------------------------
+ * slots is a power-of-two table probed linearly and kept at most half
+ * full.  The full hash of every name is remembered, so a probe compares
+ * names only when the hashes match and growing never rehashes a name.
+ * The error is raised before anything is added, so the table is left
+ * as it was.
+ */
+
+int Symbols::intern(std::string_view name) {
+  Symbols &table = instance();
+  std::lock_guard<std::mutex> guard(table.lock);
+  if (table.slots.empty()) table.slots.assign(64, -1);
+  uint64_t code = hash(name);
+  size_t mask = table.slots.size() - 1;
+  size_t i = code & mask;
+  while (table.slots[i] >= 0) {
+    int id = table.slots[i];
+    if (table.hashes[id] == code && table.names[id] == name) return id;
+    i = (i + 1) & mask;
+  }
+  if (table.names.size() >= MAX_NAMES) error("TOO MANY NAMES");
+  int id = int(table.names.size());
+  table.names.push_back(table.store(name));
+  table.hashes.push_back(code);
+  table.slots[i] = id;
+  if (table.names.size() * 2 > table.slots.size()) table.grow();
+  return id;
+}
+
+std::string_view Symbols::name(int id) {
+  Symbols &table = instance();
+  std::lock_guard<std::mutex> guard(table.lock);
+  return table.names.at(id);
+}
+
+Symbols &Symbols::instance() {
+  static Symbols table;
+  return table;
+}
+
+uint64_t Symbols::hash(std::string_view name) { //FNV-1a
+  uint64_t code = 14695981039346656037ull;
+  for (char ch: name) {
+    code = (code ^ (unsigned char) ch) * 1099511628211ull;
+  }
+  return code;
+}
+
+std::string_view Symbols::store(std::string_view name) {
+  char *copy;
+  if (name.size() > ARENA_CHUNK / 4) { //long names get a chunk of their own
+    arena.emplace(arena.begin(), new char[name.size()]);
+    copy = arena.front().get();
+  } else {
+    if (name.size() > ARENA_CHUNK - arenaUsed) {
+      arena.emplace_back(new char[ARENA_CHUNK]);
+      arenaUsed = 0;
+    }
+    copy = arena.back().get() + arenaUsed;
+    arenaUsed += name.size();
+  }
+  memcpy(copy, name.data(), name.size());
+  return std::string_view(copy, name.size());
+}
+
+void Symbols::grow() {
+  std::vector<int32_t> grown(slots.size() * 2, -1);
+  size_t mask = grown.size() - 1;
+  for (int id = 0; id < int(names.size()); id++) {
+    size_t i = hashes[id] & mask;
+    while (grown[i] >= 0) i = (i + 1) & mask;
+    grown[i] = id;
+  }
+  slots.swap(grown);
+}
@@ -0,0 +1,79 @@
+/*
+ * File: symbols.h
+ * ---------------
+ * This interface exports the Symbols class, which interns identifier
+ * names into small integers.
+ */
+
+#ifndef _symbols_h
+#define _symbols_h
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/*
+ * Class: Symbols
+ * --------------
+ * A process-wide table that gives every distinct identifier a stable
+ * id, numbered from 0 in order of first appearance.  Identifiers are
+ * interned once, while a line is parsed; from then on the parser, the
+ * statements and EvalState only pass ids around, so no identifier is
+ * hashed or compared again.  The table is an open-addressing hash whose
+ * names live in an arena that never moves, so the views returned by
+ * name stay valid.  Names are never freed, and as EvalState indexes its
+ * variables by id, a session sizes them by the highest id it uses; the
+ * table is therefore capped at MAX_NAMES, so that the sessions of a
+ * server cannot grow it, and each other's variables, without limit.
+ * All methods may be called from any thread.
+ */
+
+class Symbols {
+
+public:
+
+/*
+ * Method: intern
+ * Usage: int id = Symbols::intern(name);
+ * --------------------------------------
+ * Returns the id of name, adding it to the table if it is new.  Raises
+ * an error if it is new and the table already holds MAX_NAMES names.
+ */
+
+  static const int MAX_NAMES = 1 << 16;
+
+  static int intern(std::string_view name);
+
+/*
+ * Method: name
+ * Usage: std::string_view name = Symbols::name(id);
+ * -------------------------------------------------
+ * Returns the name with the given id.
+ */
+
+  static std::string_view name(int id);
+
+private:
+
+  static const size_t ARENA_CHUNK = 1 << 16;
+
+  std::mutex lock;
+  std::vector<int32_t> slots; //ids, -1 for empty
+  std::vector<uint64_t> hashes; //hash of each id's name
+  std::vector<std::string_view> names; //indexed by id
+  std::vector<std::unique_ptr<char[]>> arena;
+  size_t arenaUsed = ARENA_CHUNK;
+
+  static Symbols &instance();
+
+  static uint64_t hash(std::string_view name);
+
+  std::string_view store(std::string_view name);
+
+  void grow();
+
+};
+
+#endif
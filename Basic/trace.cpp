@@ -0,0 +1,99 @@
+/*
+ * File: trace.cpp
+ * ---------------
+ * This file implements the trace.h interface.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include "trace.hpp"
+#include "statement.hpp"
+#include "Utils/error.hpp"
+
+void Trace::start() {
+  if (events == nullptr) events = std::make_unique<Event[]>(BASIC_TRACE_CAPACITY);
+  count = 0;
+  on = true;
+  startTime = std::chrono::steady_clock::now();
+  startTicks = ticks();
+}
+
+void Trace::stop() {
+  if (!on) return;
+  on = false;
+  stopTime = std::chrono::steady_clock::now();
+  stopTicks = ticks();
+}
+
+/*
+ * Implementation notes: nanosPerTick
+ * ----------------------------------
+ * The cycle counter runs at a fixed rate that is not known in advance,
+ * so it is measured against the steady clock over the whole trace,
+ * which makes the error of the two readings at either end negligible.
+ */
+
+double Trace::nanosPerTick() const {
+  auto endTime = on ? std::chrono::steady_clock::now() : stopTime;
+  uint64_t endTicks = on ? ticks() : stopTicks;
+  if (endTicks <= startTicks) return 1;
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count())
+         / double(endTicks - startTicks);
+}
+
+void Trace::save(const std::string &filename) const {
+  uint64_t first = count > BASIC_TRACE_CAPACITY ? count - BASIC_TRACE_CAPACITY : 0;
+  double scale = nanosPerTick();
+  std::vector<const StatementType *> types;
+  std::unordered_map<const StatementType *, uint8_t> indices;
+  std::string body;
+  auto put = [&body](auto value) {
+    body.append((const char *) &value, sizeof(value));
+  };
+  put(uint64_t(count - first));
+  for (uint64_t i = first; i < count; i++) {
+    const Event &event = events[i & (BASIC_TRACE_CAPACITY - 1)];
+    auto result = indices.insert({event.type, uint8_t(types.size())});
+    if (result.second) types.push_back(event.type);
+    put(uint64_t(double(event.ticks - events[first & (BASIC_TRACE_CAPACITY - 1)].ticks) * scale));
+    put(int32_t(event.line));
+    put(result.first->second);
+  }
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write("BASICTRC", 8);
+  uint32_t typeCount = types.size();
+  out.write((const char *) &typeCount, sizeof(typeCount));
+  for (const StatementType *type: types) {
+    uint32_t length = type->name.size();
+    out.write((const char *) &length, sizeof(length));
+    out.write(type->name.data(), length);
+  }
+  out.write(body.data(), body.size());
+  if (!out) error("CANNOT SAVE FILE");
+}
+
+void Trace::saveJson(const std::string &filename) const {
+  uint64_t first = count > BASIC_TRACE_CAPACITY ? count - BASIC_TRACE_CAPACITY : 0;
+  double scale = nanosPerTick() / 1000; //Chrome wants microseconds
+  std::string json = "{\"traceEvents\":[";
+  char entry[256];
+  for (uint64_t i = first; i < count; i++) {
+    const Event &event = events[i & (BASIC_TRACE_CAPACITY - 1)];
+    uint64_t next = i + 1 < count ? events[(i + 1) & (BASIC_TRACE_CAPACITY - 1)].ticks : event.ticks;
+    snprintf(entry, sizeof(entry),
+             "%s\n{\"name\":\"%s\",\"cat\":\"BASIC\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+             "\"pid\":1,\"tid\":1,\"args\":{\"line\":%d}}",
+             i == first ? "" : ",", event.type->name.c_str(),
+             double(event.ticks - events[first & (BASIC_TRACE_CAPACITY - 1)].ticks) * scale,
+             double(next - event.ticks) * scale, event.line);
+    json += entry;
+  }
+  json += "\n]}\n";
+
+  std::ofstream out(filename, std::ios::trunc);
+  out << json;
+  if (!out) error("CANNOT SAVE FILE");
+}
@@ -0,0 +1,131 @@
+/*
+ * File: trace.h
+ * -------------
+ * This interface exports the Trace class, which records the statements
+ * a program runs so that the path it took can be examined afterwards.
+ */
+
+#ifndef _trace_h
+#define _trace_h
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class StatementType;
+
+/*
+ * Constant: BASIC_TRACE_CAPACITY
+ * ------------------------------
+ * How many statements a trace keeps, a power of two; older ones are
+ * overwritten.  Set it with the CMake cache variable of the same name.
+ */
+
+#ifndef BASIC_TRACE_CAPACITY
+#define BASIC_TRACE_CAPACITY 65536
+#endif
+
+/*
+ * Class: Trace
+ * ------------
+ * A ring buffer of the last BASIC_TRACE_CAPACITY statements run, each
+ * with its line number, its type and the time it started.  Only the
+ * thread running the program writes to it, and it is only read between
+ * runs, so recording takes no lock: it reads the cycle counter where
+ * there is one and stores three fields.  Times are converted to
+ * nanoseconds when the trace is saved.  A copy of a trace is empty and
+ * off, so a copied program does not trace.
+ */
+
+class Trace {
+
+public:
+
+  Trace() = default;
+
+  Trace(const Trace &) {}
+
+  Trace &operator=(const Trace &) {
+    return *this;
+  }
+
+/*
+ * Methods: start, stop, isOn
+ * Usage: trace.start();
+ *        if (trace.isOn()) . . .
+ * ------------------------------
+ * Run TRACE ON and TRACE OFF.  start empties the trace and starts
+ * recording; stop keeps what was recorded so that it can be saved.
+ */
+
+  void start();
+
+  void stop();
+
+  bool isOn() const {
+    return on;
+  }
+
+/*
+ * Method: record
+ * Usage: trace.record(line, type);
+ * --------------------------------
+ * Records that a statement of type on line starts now.  Only called
+ * while the trace is on.
+ */
+
+  void record(int line, const StatementType *type) {
+    events[count++ & (BASIC_TRACE_CAPACITY - 1)] = {ticks(), type, line};
+  }
+
+/*
+ * Methods: save, saveJson
+ * Usage: trace.save(filename);
+ *        trace.saveJson(filename);
+ * --------------------------------
+ * Write the recorded statements to filename, oldest first.  save writes
+ * a compact binary file: the magic "BASICTRC", the number of statement
+ * types and their names, the number of events and, for each, its time
+ * in nanoseconds since the first one, its line number and the index of
+ * its type, as uint64, int32 and uint8 in native byte order.  saveJson
+ * writes a Chrome trace-event file that shows each statement as a span
+ * lasting until the next one starts.
+ */
+
+  void save(const std::string &filename) const;
+
+  void saveJson(const std::string &filename) const;
+
+private:
+
+  struct Event {
+    uint64_t ticks;
+    const StatementType *type;
+    int line;
+  };
+
+  static_assert((BASIC_TRACE_CAPACITY & (BASIC_TRACE_CAPACITY - 1)) == 0, "trace capacity must be a power of two");
+
+  std::unique_ptr<Event[]> events; //allocated by the first start
+  uint64_t count = 0; //events ever recorded since start
+  bool on = false;
+  uint64_t startTicks = 0, stopTicks = 0;
+  std::chrono::steady_clock::time_point startTime, stopTime; //to convert ticks to nanoseconds
+
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  double nanosPerTick() const;
+
+};
+
+#endif
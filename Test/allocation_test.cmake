@@ -0,0 +1,21 @@
+# Runs PROGRAM, built with BASIC_ALLOCATION_STATS, on a session that parses
+# and runs a program with an array, then checks that STATS reports a row
+# for every subsystem and charges the parser, the evaluator and the
+# program for what they allocated.
+file(WRITE ${WORK_DIR}/allocation.txt "10 DIM A(1000)\n20 LET A(1000) = 1\nRUN\nSTATS\n")
+execute_process(COMMAND ${PROGRAM} INPUT_FILE ${WORK_DIR}/allocation.txt
+                OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+if (NOT result EQUAL 0 OR NOT output MATCHES "\nSUBSYSTEM +ALLOCATIONS +BYTES +LIVE BYTES\n")
+    message(FATAL_ERROR "STATS exited with ${result} and printed:\n${output}")
+endif ()
+foreach (subsystem OTHER PARSER EVALUATOR PROGRAM IO)
+    if (NOT output MATCHES "\n${subsystem} +([0-9]+) +([0-9]+) +([0-9]+)\n")
+        message(FATAL_ERROR "STATS has no row for ${subsystem}:\n${output}")
+    endif ()
+    if (NOT subsystem MATCHES "OTHER|IO" AND (CMAKE_MATCH_1 EQUAL 0 OR CMAKE_MATCH_2 LESS CMAKE_MATCH_3))
+        message(FATAL_ERROR "STATS charged nothing, or more live bytes than bytes, to ${subsystem}:\n${output}")
+    endif ()
+endforeach ()
+if (NOT output MATCHES "\nEVALUATOR +[0-9]+ +([0-9]+)" OR CMAKE_MATCH_1 LESS 4000)
+    message(FATAL_ERROR "STATS did not charge the array to EVALUATOR:\n${output}")
+endif ()
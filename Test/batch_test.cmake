@@ -0,0 +1,18 @@
+# Runs PROGRAM with --batch over records written to WORK_DIR and checks
+# that the output of every record comes out complete and in the order
+# of the records, including records with too few or invalid fields.
+file(WRITE ${WORK_DIR}/batch.bas "10 INPUT A\n20 INPUT B\n30 PRINT A * 1000 + B\n")
+set(records "x,5\n7\n")
+set(expected " ? INVALID NUMBER\n ?  ? NO MORE INPUT\n ?  ? NO MORE INPUT\n")
+foreach (i RANGE 1 2000)
+    math(EXPR sum "${i} * 1000 + ${i} % 7")
+    math(EXPR b "${i} % 7")
+    string(APPEND records "${i},${b}\n")
+    string(APPEND expected " ?  ? ${sum}\n")
+endforeach ()
+file(WRITE ${WORK_DIR}/batch.txt "${records}")
+execute_process(COMMAND ${PROGRAM} --batch ${WORK_DIR}/batch.bas ${WORK_DIR}/batch.txt
+                OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+if (NOT result EQUAL 0 OR NOT output STREQUAL expected)
+    message(FATAL_ERROR "--batch exited with ${result} and printed:\n${output}")
+endif ()
@@ -0,0 +1,59 @@
+/*
+ * File: assignment.cpp
+ * --------------------
+ * Times the evaluation of a chain of assignments, A = (B = (C = D + 1)),
+ * through the public API, once by walking the expression tree and once
+ * as a CompiledExp, and prints the nanoseconds per evaluation of each.
+ * Build it with the assignment_bench target, in a Release build.  Takes
+ * the number of evaluations as an optional argument, 2000000 by default.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include "evalstate.hpp"
+#include "exp.hpp"
+#include "parser.hpp"
+
+namespace {
+
+const char *const EXPRESSION = "A = (B = (C = D + 1))";
+
+template <typename Eval>
+double nanosPerEval(long count, Eval eval) { //the best of five rounds
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+      eval();
+    }
+    std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+    if (round == 0 || time.count() < best) best = time.count();
+  }
+  return best / double(count);
+}
+
+}
+
+int main(int argc, char **argv) {
+  long count = argc > 1 ? std::atol(argv[1]) : 2000000;
+  if (count <= 0) {
+    std::cerr << "usage: " << argv[0] << " [EVALUATIONS]\n";
+    return 2;
+  }
+  EvalState state;
+  state.setValue("D", 1);
+  TokenScanner scanner;
+  scanner.ignoreWhitespace();
+  scanner.setInput(EXPRESSION);
+  std::unique_ptr<Expression> tree(parseExp(scanner));
+  CompiledExp compiled = compileExp(EXPRESSION);
+  volatile Value sink = 0; //keeps the results alive
+  double treeNanos = nanosPerEval(count, [&]() { sink = tree->eval(state); });
+  double compiledNanos = nanosPerEval(count, [&]() { sink = compiled.eval(state); });
+  std::cout << EXPRESSION << ", " << count << " evaluations, best of 5\n"
+            << "tree eval      " << treeNanos << " ns\n"
+            << "compiled eval  " << compiledNanos << " ns\n";
+  return 0;
+}
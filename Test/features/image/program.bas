@@ -0,0 +1,2 @@
+10 LET B = 5
+20 PRINT B + 1
@@ -0,0 +1,16 @@
+# Runs PROGRAM, with the command line options in OPTIONS if any, with
+# INPUT as its standard input and checks that it prints exactly what
+# EXPECTED holds.  It runs in WORK_DIR, which starts out with a copy of
+# the files in FILES if that directory exists, so the input can SAVE and
+# LOAD files by their bare names.
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+if (IS_DIRECTORY ${FILES})
+    file(COPY ${FILES}/ DESTINATION ${WORK_DIR})
+endif ()
+execute_process(COMMAND ${PROGRAM} ${OPTIONS} INPUT_FILE ${INPUT} OUTPUT_VARIABLE output ERROR_VARIABLE output
+                RESULT_VARIABLE result TIMEOUT 60 WORKING_DIRECTORY ${WORK_DIR})
+file(READ ${EXPECTED} expected)
+if (NOT result EQUAL 0 OR NOT output STREQUAL expected)
+    message(FATAL_ERROR "${INPUT} exited with ${result} and printed:\n${output}")
+endif ()
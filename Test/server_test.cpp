@@ -0,0 +1,161 @@
+/*
+ * File: server_test.cpp
+ * ---------------------
+ * Starts the interpreter given as the only argument with --serve on a
+ * socket in a fresh temporary directory and talks to it the way clients
+ * do, checking what each session prints.  Exits with 1 on the first
+ * check that fails, or when the checks take so long that the server
+ * must be stuck.
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+std::string socketPath;
+
+void fail(const std::string &message) {
+  std::cerr << "FAILED: " << message << '\n';
+  exit(1);
+}
+
+pid_t startServer(const std::string &program, const std::vector<std::string> &options) {
+  std::vector<std::string> args = {program};
+  args.insert(args.end(), options.begin(), options.end());
+  args.push_back("--serve");
+  args.push_back(socketPath);
+  pid_t pid = fork();
+  if (pid < 0) fail("fork");
+  if (pid == 0) {
+    std::vector<char *> argv;
+    for (auto &arg: args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  return pid;
+}
+
+void stopServer(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
+
+int connectToServer() { //waits for the server to listen
+  for (int attempt = 0; attempt < 500; attempt++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) fail("socket");
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(fd, (sockaddr *) &address, sizeof(address)) == 0) return fd;
+    close(fd);
+    usleep(10000);
+  }
+  fail("cannot connect to " + socketPath);
+  return -1;
+}
+
+int sendScript(const std::string &script) { //returns the connection, to read the output from
+  int fd = connectToServer();
+  if (send(fd, script.data(), script.size(), MSG_NOSIGNAL) != ssize_t(script.size())) fail("send");
+  shutdown(fd, SHUT_WR);
+  return fd;
+}
+
+std::string receive(int fd) { //everything the session prints, then closes the connection
+  std::string output;
+  char chunk[1 << 12];
+  ssize_t count;
+  while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+    output.append(chunk, count);
+  }
+  close(fd);
+  return output;
+}
+
+std::string talk(const std::string &script) {
+  return receive(sendScript(script));
+}
+
+void expect(const std::string &script, const std::string &expected) {
+  std::string output = talk(script);
+  if (output != expected) fail("sent\n" + script + "expected\n" + expected + "got\n" + output);
+}
+
+/*
+ * Sessions that end at once, some of them before their input has even
+ * been read, finish while the server still polls their connections.
+ */
+void testManyConnections(const std::string &program) {
+  pid_t server = startServer(program, {});
+  for (int i = 0; i < 200; i++) {
+    expect("PRINT " + std::to_string(i) + "\nQUIT\n", std::to_string(i) + "\n");
+    close(connectToServer());
+  }
+  expect("10 PRINT 42\nRUN\n", "42\n");
+  stopServer(server);
+}
+
+/*
+ * A program that never ends is aborted, and its session goes on.
+ */
+void testLimits(const std::string &program) {
+  pid_t server = startServer(program, {"--step-limit", "100000"});
+  expect("10 GOTO 10\nRUN\nPRINT 7\n", "STEP LIMIT EXCEEDED\n7\n");
+  stopServer(server);
+  server = startServer(program, {"--time-limit", "100"});
+  expect("10 GOTO 10\nRUN\nPRINT 7\n", "TIME LIMIT EXCEEDED\n7\n");
+  stopServer(server);
+}
+
+
+/*
+ * Clients that do not read their output while their programs print far
+ * more than a socket holds neither lose any of it nor hold up the
+ * sessions of other clients.
+ */
+void testSlowReaders(const std::string &program) {
+  pid_t server = startServer(program, {});
+  std::string script = "10 FOR I = 1 TO 50000\n20 PRINT 1000000000 + I\n30 NEXT I\nRUN\n";
+  std::vector<int> readers;
+  for (int i = 0; i < 32; i++) {
+    readers.push_back(sendScript(script));
+  }
+  expect("PRINT 7\n", "7\n");
+  for (int fd: readers) {
+    std::string output = receive(fd);
+    if (output.size() != 50000 * 11 || output.compare(output.size() - 11, 11, "1000050000\n") != 0) {
+      fail("slow reader got " + std::to_string(output.size()) + " bytes");
+    }
+  }
+  stopServer(server);
+}
+
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " INTERPRETER\n";
+    return 2;
+  }
+  alarm(120);
+  char directory[] = "/tmp/basic-server-XXXXXX";
+  if (mkdtemp(directory) == nullptr) fail("mkdtemp");
+  socketPath = std::string(directory) + "/socket";
+  testManyConnections(argv[1]);
+  testLimits(argv[1]);
+  testSlowReaders(argv[1]);
+  unlink(socketPath.c_str());
+  rmdir(directory);
+  return 0;
+}
@@ -0,0 +1,19 @@
+# Runs PROGRAM on one session that it saves with --snapshot to a file in
+# WORK_DIR, then on a second that starts from it with --restore, and
+# checks that the program, variables, arrays and functions carried over.
+function(run_session options input expected)
+    file(WRITE ${WORK_DIR}/session.txt "${input}")
+    execute_process(COMMAND ${PROGRAM} ${options} INPUT_FILE ${WORK_DIR}/session.txt
+                    OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+    if (NOT result EQUAL 0 OR NOT output STREQUAL expected)
+        message(FATAL_ERROR "${options} exited with ${result} and printed:\n${output}")
+    endif ()
+endfunction()
+
+file(REMOVE ${WORK_DIR}/session.snp)
+run_session("--snapshot;${WORK_DIR}/session.snp"
+            "10 PRINT K * 2\n20 DIM A(3)\n30 LET A(3) = K\nLET K = 21\nDEF FNF(X) = X + K\nRUN\n"
+            "42\n")
+run_session("--restore;${WORK_DIR}/session.snp"
+            "PRINT K\nPRINT A(3)\nPRINT FNF(1)\nLIST\nRUN\n"
+            "21\n21\n22\n10 PRINT K * 2\n20 DIM A(3)\n30 LET A(3) = K\n42\n")
@@ -0,0 +1,23 @@
+# Runs PROGRAM on a session that traces one RUN of a program but not a
+# second, saves the trace with TRACE SAVE and TRACE JSON to WORK_DIR, and
+# checks that both files hold the traced statements and nothing more.
+file(REMOVE ${WORK_DIR}/run.trc ${WORK_DIR}/run.json)
+file(WRITE ${WORK_DIR}/trace.txt "10 FOR I = 1 TO 2\n20 PRINT I\n30 NEXT I\n"
+     "TRACE ON\nRUN\nTRACE OFF\nRUN\nTRACE SAVE run.trc\nTRACE JSON run.json\n")
+execute_process(COMMAND ${PROGRAM} INPUT_FILE ${WORK_DIR}/trace.txt WORKING_DIRECTORY ${WORK_DIR}
+                OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+if (NOT result EQUAL 0 OR NOT output STREQUAL "1\n2\n1\n2\n")
+    message(FATAL_ERROR "TRACE exited with ${result} and printed:\n${output}")
+endif ()
+
+file(READ ${WORK_DIR}/run.trc magic LIMIT 8 HEX)
+if (NOT magic STREQUAL "4241534943545243") # BASICTRC
+    message(FATAL_ERROR "TRACE SAVE wrote a file that begins with '${magic}'")
+endif ()
+
+file(READ ${WORK_DIR}/run.json json)
+string(REGEX MATCHALL "\"name\":\"[A-Z]+\"[^}]*\"args\":{\"line\":[0-9]+}" events "${json}")
+string(REGEX REPLACE "\"name\":\"([A-Z]+)\"[^;]*\"line\":([0-9]+)}" "\\1 \\2" events "${events}")
+if (NOT json MATCHES "^{\"traceEvents\":\\[" OR NOT events STREQUAL "FOR 10;PRINT 20;NEXT 30;PRINT 20;NEXT 30")
+    message(FATAL_ERROR "TRACE JSON wrote events '${events}' in:\n${json}")
+endif ()